@@ -0,0 +1,52 @@
+// Alloccount.cpp
+// Counting replacements of the global operator new. The array and
+// nothrow forms of the standard library all end up in these.
+
+#include "alloccount.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<uint64_t> g_allocations(0);
+
+uint64_t allocation_count() {
+	return g_allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t bytes) {
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = std::malloc(std::max<size_t>(bytes, 1));
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	std::free(p);
+}
+
+// aligned_alloc wants the size rounded up to the alignment.
+void* operator new(size_t bytes, std::align_val_t align) {
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	size_t a = static_cast<size_t>(align);
+	size_t rounded = (std::max<size_t>(bytes, 1) + a - 1) / a * a;
+	void* p = std::aligned_alloc(a, rounded);
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+	std::free(p);
+}
@@ -0,0 +1,16 @@
+// Alloccount.h
+// Counts calls to the global operator new, to check that a steady
+// update doesn't make any. Only boids_headless links it, since it
+// replaces operator new for the whole program.
+
+#ifndef _ALLOCCOUNT_H_
+#define _ALLOCCOUNT_H_
+
+#include <cstdint>
+
+// Calls to the global operator new since the program started,
+// aligned ones included. Every std container allocation goes
+// through it, but plain malloc calls (TBB's own) aren't counted.
+uint64_t allocation_count();
+
+#endif
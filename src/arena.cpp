@@ -0,0 +1,60 @@
+// Arena.cpp
+// Member function definitions for FrameArena.
+
+#include "arena.hpp"
+#include <cstddef>
+
+// Worst alignment we hand out, and what new char[] already gives us.
+static const size_t MAX_ALIGN = alignof(std::max_align_t);
+
+FrameArena::FrameArena(size_t capacity):
+	_m_capacity(capacity),
+	_m_used(0),
+	_m_overflow_bytes(0)
+{
+	_mp_block = new char[_m_capacity];
+}
+
+FrameArena::~FrameArena() {
+	for (char* p_block : _m_overflow) {
+		delete[] p_block;
+	}
+	delete[] _mp_block;
+}
+
+void* FrameArena::alloc_bytes(size_t bytes, size_t align) {
+	size_t offset = (_m_used + align - 1) & ~(align - 1);
+	if (offset + bytes <= _m_capacity) {
+		_m_used = offset + bytes;
+		return _mp_block + offset;
+	}
+	// Full, only happens while the frames are still growing.
+	char* p_block = new char[bytes + MAX_ALIGN];
+	_m_overflow.push_back(p_block);
+	_m_overflow_bytes += bytes + MAX_ALIGN;
+	return p_block;
+}
+
+void FrameArena::reset() {
+	if (!_m_overflow.empty()) {
+		for (char* p_block : _m_overflow) {
+			delete[] p_block;
+		}
+		// Some headroom, so a frame that's a little bigger still fits.
+		size_t needed = _m_capacity + _m_overflow_bytes;
+		delete[] _mp_block;
+		_m_capacity = needed + needed / 4;
+		_mp_block = new char[_m_capacity];
+		_m_overflow.clear();
+		_m_overflow_bytes = 0;
+	}
+	_m_used = 0;
+}
+
+size_t FrameArena::get_used() const {
+	return _m_used;
+}
+
+size_t FrameArena::get_capacity() const {
+	return _m_capacity;
+}
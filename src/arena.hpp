@@ -0,0 +1,47 @@
+// Arena.h
+// Bump allocator for scratch memory that only lives for one update.
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <cstddef>
+#include <vector>
+
+// Hands out memory by bumping an offset into one block, reset()
+// frees all of it at once. Nothing is constructed or destructed,
+// so only use it for plain data.
+class FrameArena {
+public:
+	FrameArena(size_t capacity=1 << 16);
+	~FrameArena();
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	// Room for count Ts, uninitialized.
+	template <typename T>
+	T* alloc(size_t count);
+
+	// Frees everything in O(1). If the block ran out since the last
+	// reset, it's swapped for one that fits everything that was
+	// asked for, so the next frame of the same size doesn't allocate.
+	void reset();
+
+	size_t get_used() const;
+	size_t get_capacity() const;
+private:
+	void* alloc_bytes(size_t bytes, size_t align);
+
+	char* _mp_block;
+	size_t _m_capacity;
+	size_t _m_used;
+	// Blocks made once the main one was full, and their total size.
+	std::vector<char*> _m_overflow;
+	size_t _m_overflow_bytes;
+};
+
+template <typename T>
+T* FrameArena::alloc(size_t count) {
+	return static_cast<T*>(alloc_bytes(sizeof(T) * count, alignof(T)));
+}
+
+#endif
@@ -0,0 +1,300 @@
+// Bench.cpp
+// Benchmarks Flightspace::update() across flock sizes, densities,
+// obstacle counts and thread counts. Prints per-phase percentiles
+// as CSV or JSON so runs can be diffed and graphed.
+
+// Only uses the simulation core.
+#include "classes.hpp"
+#include "rng.hpp"
+#include <tbb/global_control.h>
+#include <tbb/info.h>
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Command line options, every sweep axis takes a comma separated list.
+struct BenchOptions {
+	std::vector<int> boids = {1000, 10000, 100000, 1000000};
+	// Boids per 100x100 patch of world.
+	std::vector<float> densities = {2.0f};
+	std::vector<int> obstacles = {0, 200};
+	// Perception radii, the cell size follows the radius.
+	std::vector<float> perceptions = {20.0f};
+	std::vector<int> threads = {1, 0}; // 0 = all cores, "all" on the command line.
+	int frames = 30;
+	int warmup = 5;
+	bool json = false;
+};
+
+// One benchmark configuration.
+struct BenchCase {
+	int boids;
+	float density;
+	int obstacles;
+	float perception;
+	int threads;
+};
+
+// Per-phase percentiles in milliseconds.
+struct PhaseStats {
+	std::string phase;
+	double p50, p90, p99, max, mean;
+};
+
+void print_usage(const char* exec);
+bool parse_args(int argc, char* args[], BenchOptions& options);
+std::vector<PhaseStats> run_case(const BenchCase& bench_case, const BenchOptions& options);
+// Square world sized for the density.
+double world_side(int boids, float density) {
+	return std::max(100.0, std::sqrt(boids / (double)density * 100.0 * 100.0));
+}
+
+PhaseStats summarize(const std::string& phase, std::vector<double> samples);
+double world_side(int boids, float density);
+
+int main(int argc, char* args[]) {
+	BenchOptions options;
+	if (!parse_args(argc, args, options)) {
+		print_usage(args[0]);
+		return 1;
+	}
+
+	const char* kernel = kernel_name(best_kernel_type());
+	if (options.json) {
+		std::cout << "[\n";
+	}
+	else {
+		std::cout << "boids,density,obstacles,perception,threads,kernel,phase,"
+			<< "p50_ms,p90_ms,p99_ms,max_ms,mean_ms\n";
+	}
+
+	bool first = true;
+	for (int boids : options.boids) {
+		for (float density : options.densities) {
+			for (int obstacles : options.obstacles) {
+				for (float perception : options.perceptions) {
+					for (int threads : options.threads) {
+						if (threads <= 0) { threads = tbb::info::default_concurrency(); }
+						BenchCase bench_case = {boids, density, obstacles, perception, threads};
+						for (const PhaseStats& stats : run_case(bench_case, options)) {
+							if (options.json) {
+								std::cout << (first? "" : ",\n")
+									<< "  {\"boids\": " << boids
+									<< ", \"density\": " << density
+									<< ", \"obstacles\": " << obstacles
+									<< ", \"perception\": " << perception
+									<< ", \"threads\": " << threads
+									<< ", \"kernel\": \"" << kernel << "\""
+									<< ", \"phase\": \"" << stats.phase << "\""
+									<< ", \"p50_ms\": " << stats.p50
+									<< ", \"p90_ms\": " << stats.p90
+									<< ", \"p99_ms\": " << stats.p99
+									<< ", \"max_ms\": " << stats.max
+									<< ", \"mean_ms\": " << stats.mean << "}";
+							}
+							else {
+								std::cout << boids << "," << density << ","
+									<< obstacles << "," << perception << ","
+									<< threads << "," << kernel << ","
+									<< stats.phase << "," << stats.p50 << ","
+									<< stats.p90 << "," << stats.p99 << ","
+									<< stats.max << "," << stats.mean << "\n";
+							}
+							first = false;
+						}
+					}
+				}
+			}
+		}
+	}
+	if (options.json) {
+		std::cout << "\n]\n";
+	}
+	return 0;
+}
+
+std::vector<PhaseStats> run_case(const BenchCase& bench_case, const BenchOptions& options) {
+	tbb::global_control thread_limit(
+		tbb::global_control::max_allowed_parallelism, bench_case.threads);
+
+	int side = world_side(bench_case.boids, bench_case.density);
+
+	Flightspace flock;
+	// Fixed seed so every run of a case starts from the same state.
+	const uint64_t seed = 1234;
+	ObstacleGroup obs_group(50, 0, bench_case.obstacles);
+	std::vector<float> obs_x(bench_case.obstacles), obs_y(bench_case.obstacles);
+	fill_uniform(obs_x.data(), bench_case.obstacles, 0, side, seed, 0);
+	fill_uniform(obs_y.data(), bench_case.obstacles, 0, side, seed, 1);
+	for (int i = 0; i < bench_case.obstacles; i++) {
+		obs_group.add_obstacle(obs_x[i], obs_y[i]);
+	}
+	flock.set_perception(bench_case.perception);
+	flock.set_bounds(-20, -20, side+20, side+20);
+	flock.random_populate(bench_case.boids, side, side, 3.25, 0.3, 0.0, 0.0, seed);
+	flock.set_obstacles(&obs_group);
+
+	// Moving and wrapping happen inside the rule pass.
+	std::vector<double> hash_ms, rules_ms, total_ms;
+	for (int frame = 0; frame < options.warmup + options.frames; frame++) {
+		auto start = std::chrono::steady_clock::now();
+		flock.update();
+		auto updated = std::chrono::steady_clock::now();
+
+		if (frame >= options.warmup) {
+			UpdateTimes times = flock.get_update_times();
+			hash_ms.push_back(times.hash_ms);
+			rules_ms.push_back(times.rules_ms);
+			total_ms.push_back(
+				std::chrono::duration<double, std::milli>(updated - start).count());
+		}
+	}
+
+	return {
+		summarize("hash", hash_ms),
+		summarize("rules", rules_ms),
+		summarize("total", total_ms)
+	};
+}
+
+PhaseStats summarize(const std::string& phase, std::vector<double> samples) {
+	PhaseStats stats = {phase, 0.0, 0.0, 0.0, 0.0, 0.0};
+	if (samples.empty()) {
+		return stats;
+	}
+	std::sort(samples.begin(), samples.end());
+	// Nearest rank percentiles.
+	auto percentile = [&](double p) {
+		int rank = (int)std::ceil(p / 100.0 * samples.size()) - 1;
+		return samples[std::max(0, rank)];
+	};
+	stats.p50 = percentile(50);
+	stats.p90 = percentile(90);
+	stats.p99 = percentile(99);
+	stats.max = samples.back();
+	for (double sample : samples) {
+		stats.mean += sample;
+	}
+	stats.mean /= samples.size();
+	return stats;
+}
+
+void print_usage(const char* exec) {
+	std::cout << "Usage: " << exec << " [options]\n"
+		<< "  Lists are comma separated, every combination is run.\n"
+		<< "  --boids LIST      Flock sizes (1000,10000,100000,1000000)\n"
+		<< "  --density LIST    Boids per 100x100 patch (2)\n"
+		<< "  --obstacles LIST  Obstacle counts (0,200)\n"
+		<< "  --perception LIST Perception radii (20)\n"
+		<< "  --threads LIST    Thread counts, all for every core (1,all)\n"
+		<< "  --frames N        Timed frames per case (30)\n"
+		<< "  --warmup N        Untimed frames per case (5)\n"
+		<< "  --json            JSON output instead of CSV\n"
+		<< "  --help            Show this message\n";
+}
+
+// Splits a comma separated list of numbers, 0 is only taken
+// if it isn't positive. Lists of ints only take whole numbers
+// that fit, strtod() also reads "inf" and "nan", and casting
+// those or anything past INT_MAX to int is undefined.
+template <typename T>
+bool parse_list(const std::string& text, std::vector<T>& out, bool positive) {
+	out.clear();
+	std::stringstream stream(text);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		char* end = nullptr;
+		double value = std::strtod(item.c_str(), &end);
+		double max = std::is_integral<T>::value? INT_MAX : FLT_MAX;
+		if (item.empty() || *end != '\0' || !is_finite(value) ||
+			value < 0.0 || (positive && value == 0.0) || value > max ||
+			(std::is_integral<T>::value && value != std::floor(value)))
+		{
+			return false;
+		}
+		out.push_back((T)value);
+	}
+	return !out.empty();
+}
+
+// Thread counts, where "all" (kept as 0) is every core.
+bool parse_threads(const std::string& text, std::vector<int>& out) {
+	out.clear();
+	std::stringstream stream(text);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		std::vector<int> count = {0};
+		if (item != "all" && !parse_list(item, count, true)) {
+			return false;
+		}
+		out.push_back(count[0]);
+	}
+	return !out.empty();
+}
+
+// A list with exactly one number.
+bool parse_number(const std::string& text, int& out) {
+	std::vector<int> values;
+	if (!parse_list(text, values, false) || values.size() != 1) {
+		return false;
+	}
+	out = values[0];
+	return true;
+}
+
+bool parse_args(int argc, char* args[], BenchOptions& options) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = args[i];
+		if (arg == "--json") {
+			options.json = true;
+			continue;
+		}
+		if (arg == "--help") {
+			return false;
+		}
+		// Everything else takes a value.
+		if (i + 1 >= argc) {
+			std::cout << "Missing value for " << arg << "\n";
+			return false;
+		}
+		std::string value = args[++i];
+		bool parsed = true;
+		if (arg == "--boids") { parsed = parse_list(value, options.boids, false); }
+		else if (arg == "--density") { parsed = parse_list(value, options.densities, true); }
+		else if (arg == "--obstacles") { parsed = parse_list(value, options.obstacles, false); }
+		else if (arg == "--perception") { parsed = parse_list(value, options.perceptions, true); }
+		else if (arg == "--threads") { parsed = parse_threads(value, options.threads); }
+		else if (arg == "--frames") { parsed = parse_number(value, options.frames); }
+		else if (arg == "--warmup") { parsed = parse_number(value, options.warmup); }
+		else {
+			std::cout << "Unknown option " << arg << "\n";
+			return false;
+		}
+		if (!parsed) {
+			std::cout << "Bad value for " << arg << ": " << value << "\n";
+			return false;
+		}
+	}
+	// A sparse flock or a small radius can ask for more grid than fits.
+	for (int boids : options.boids) {
+		for (float density : options.densities) {
+			for (float perception : options.perceptions) {
+				float side = world_side(boids, density);
+				if (!world_fits({-20.0f, -20.0f, side + 20.0f, side + 20.0f}, perception)) {
+					std::cout << boids << " boids at density " << density
+						<< " and perception " << perception << " make too big a grid\n";
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
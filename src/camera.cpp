@@ -0,0 +1,70 @@
+// Camera.cpp
+// Member function definitions for Camera.
+
+#include "camera.hpp"
+#include <algorithm>
+
+const float Camera::_M_MIN_ZOOM = 0.02f;
+const float Camera::_M_MAX_ZOOM = 8.0f;
+
+Camera::Camera(float screen_w, float screen_h):
+	_m_x(0.0f),
+	_m_y(0.0f),
+	_m_zoom(1.0f),
+	_m_screen_w(screen_w),
+	_m_screen_h(screen_h)
+{}
+
+void Camera::set_screen(float screen_w, float screen_h) {
+	_m_screen_w = screen_w;
+	_m_screen_h = screen_h;
+}
+
+void Camera::set_position(float x, float y) {
+	_m_x = x;
+	_m_y = y;
+}
+
+void Camera::reset() {
+	_m_x = 0.0f;
+	_m_y = 0.0f;
+	_m_zoom = 1.0f;
+}
+
+void Camera::pan(float screen_dx, float screen_dy) {
+	_m_x += screen_dx / _m_zoom;
+	_m_y += screen_dy / _m_zoom;
+}
+
+void Camera::zoom_at(float factor, float screen_x, float screen_y) {
+	float world_x = to_world_x(screen_x);
+	float world_y = to_world_y(screen_y);
+	_m_zoom = std::min(_M_MAX_ZOOM, std::max(_M_MIN_ZOOM, _m_zoom * factor));
+	// Move so the same world point is under the cursor again.
+	_m_x = world_x - screen_x / _m_zoom;
+	_m_y = world_y - screen_y / _m_zoom;
+}
+
+float Camera::to_screen_x(float x) const {
+	return (x - _m_x) * _m_zoom;
+}
+
+float Camera::to_screen_y(float y) const {
+	return (y - _m_y) * _m_zoom;
+}
+
+float Camera::to_world_x(float screen_x) const {
+	return _m_x + screen_x / _m_zoom;
+}
+
+float Camera::to_world_y(float screen_y) const {
+	return _m_y + screen_y / _m_zoom;
+}
+
+WorldBounds Camera::get_view() const {
+	return {_m_x, _m_y, to_world_x(_m_screen_w), to_world_y(_m_screen_h)};
+}
+
+float Camera::get_zoom() const {
+	return _m_zoom;
+}
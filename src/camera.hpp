@@ -0,0 +1,44 @@
+// Camera.h
+// Pan and zoom over a world that can be bigger than the window.
+
+#ifndef _CAMERA_H_
+#define _CAMERA_H_
+
+#include "classes.hpp"
+
+// Maps world coordinates to screen pixels.
+// Screen = (world - position) * zoom.
+class Camera {
+public:
+	Camera(float screen_w=1280, float screen_h=720);
+
+	void set_screen(float screen_w, float screen_h);
+	// World point at the top left of the screen.
+	void set_position(float x, float y);
+	void reset();
+
+	// Moves the view by a distance in screen pixels.
+	void pan(float screen_dx, float screen_dy);
+	// Zooms by factor, keeping the world point under
+	// (screen_x, screen_y) where it is.
+	void zoom_at(float factor, float screen_x, float screen_y);
+
+	float to_screen_x(float x) const;
+	float to_screen_y(float y) const;
+	float to_world_x(float screen_x) const;
+	float to_world_y(float screen_y) const;
+
+	// The world rectangle on screen.
+	WorldBounds get_view() const;
+	float get_zoom() const;
+private:
+	// Zoom limits.
+	static const float _M_MIN_ZOOM;
+	static const float _M_MAX_ZOOM;
+
+	float _m_x, _m_y;
+	float _m_zoom;
+	float _m_screen_w, _m_screen_h;
+};
+
+#endif
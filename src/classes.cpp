@@ -6,7 +6,17 @@
 // Uses classes.h and rng.h for random number distribution.
 #include "classes.hpp"
 #include "rng.hpp"
+#include "profiler.hpp"
 #include <iostream>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <tbb/parallel_reduce.h>
+#include <tbb/parallel_scan.h>
+#include <tbb/parallel_sort.h>
+#include <tbb/task_arena.h>
+#include <atomic>
 
 // Member function definitions for Vector2
 // Operator overloads
@@ -64,123 +74,280 @@ float Boid::m_align = 1.35;
 float Boid::m_cohede = 2.05;
 float Boid::m_avoid = 5.0;
 
-// Boid perception radii
-const int Boid::_M_PERCEPT = 20;
+// Member function definitions for FlockData
+void FlockData::push_back(const Vector2& position, const Vector2& dir,
+	float boid_speed, float boid_agility, uint8_t boid_species)
+{
+	x.push_back(position.x);
+	y.push_back(position.y);
+	dx.push_back(dir.x);
+	dy.push_back(dir.y);
+	speed.push_back(boid_speed);
+	agility.push_back(boid_agility);
+	species.push_back(boid_species);
+	neighbors.push_back(0);
+	id.push_back(id.size());
+	slot.push_back(slot.size());
+}
+
+void FlockData::reserve(int capacity) {
+	x.reserve(capacity); y.reserve(capacity);
+	dx.reserve(capacity); dy.reserve(capacity);
+	speed.reserve(capacity); agility.reserve(capacity);
+	species.reserve(capacity);
+	neighbors.reserve(capacity);
+	id.reserve(capacity); slot.reserve(capacity);
+}
+
+void FlockData::resize(int size) {
+	x.resize(size); y.resize(size);
+	dx.resize(size); dy.resize(size);
+	speed.resize(size); agility.resize(size);
+	species.resize(size);
+	neighbors.resize(size);
+	for (int s = id.size(); s < size; s++) {
+		id.push_back(s);
+		slot.push_back(s);
+	}
+	id.resize(size); slot.resize(size);
+}
+
+void FlockData::clear() {
+	x.clear(); y.clear();
+	dx.clear(); dy.clear();
+	speed.clear(); agility.clear();
+	species.clear();
+	neighbors.clear();
+	id.clear(); slot.clear();
+}
+
+int FlockData::size() const {
+	return x.size();
+}
+
+void FlockData::reset_ids() {
+	id.resize(size());
+	slot.resize(size());
+	for (int s = 0; s < size(); s++) {
+		id[s] = s;
+		slot[s] = s;
+	}
+}
 
 // Member function definitions for Boid
-Boid::Boid(Vector2 position, Vector2 dir,
-	float speed, float agility):
-	_m_speed(speed),
-    _m_agility(agility),
-    _m_position(position),
-    _m_dir(dir)
+Boid::Boid(FlockData* p_flock, int index):
+	_mp_flock(p_flock),
+	_m_index(index)
 {}
 
 // Boid behaviour 1: separation.
-Vector2 Boid::compute(boid_hash* p_hash, obs_hash* p_obs_hash) {
-	// Separation.
-	Vector2 separate(0.0, 0.0);
-	Vector2 s_steer(0.0, 0.0);
-	// Alignment.
-	Vector2 align(0.0, 0.0);
-	int align_locals = 0;
-	// Cohesion.
-	// Uses c_vector to average locals' position, then to get the turn
-	// vector to that position.
-	Vector2 c_vector(0.0, 0.0);
-	int cohede_locals = 0;
-
-	// Look through our key.
-	std::vector<Boid*>* local_cell = &(p_hash->at(_m_cell));
-
-	// Traverse all boids in the same cell.
-    for (auto it : *local_cell) {
-		Boid* p_boid = it;
-		float dist = _m_position.distance_to(p_boid->get_pos());
-		if (p_boid != this && dist < _M_PERCEPT) {
-			// Separation.
-			s_steer = _m_position - p_boid->get_pos();
-			separate = separate + s_steer.scaled((_M_PERCEPT - dist) / _M_PERCEPT);
-			// Alignment.
-			align = align + p_boid->get_direction();
-			++align_locals;
-			// Cohesion (getting center of mass)
-			c_vector = c_vector + p_boid->get_pos();
-			++cohede_locals;
+template <int SPAN>
+Vector2 Boid::compute(const RuleContext& context, RuleVisits& rule_visits,
+	int& neighbors) const
+{
+	Vector2 position = get_pos();
+	const float percept = context.perception;
+	const NeighborData* p_sorted = context.p_sorted;
+	const BucketGrid* p_obstacles = context.p_obstacles;
+	flock_kernel kernel = context.kernel;
+	const SpeciesTable* p_species = context.p_species;
+	int species = get_species();
+	const InteractionRow* p_row =
+		(p_species->count > 1)? &p_species->interaction[species] : nullptr;
+
+	// Separation, alignment and cohesion sums,
+	// the kernel streams through the cell-sorted flock.
+	FlockSums sums = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0};
+
+	// Traverse all boids in the cells touching our perception,
+	// or every boid for the reference search.
+	int visits = 0;
+	if (context.p_lists != nullptr) {
+		// The slot kernel reads the candidates where they are. Boids
+		// that wrapped are far from their place on the lists, so it
+		// drops them there, the ones near us are chained into our cell.
+		const NeighborLists* p_lists = context.p_lists;
+		auto visit_slots = [&](const int* slots, int count) {
+			context.list_kernel(p_lists->boids, slots, count, position.x, position.y,
+				_m_index, percept, p_row, sums);
+			visits += count;
+		};
+		if (p_lists->is_stray[_m_index]) {
+			// Our list is from the other side of the world.
+			const int* cell_slots = p_lists->cell_slots.data();
+			context.p_grid->query_rows(position.x, position.y, p_lists->stray_reach,
+			[&](int begin, int end) {
+				visit_slots(cell_slots + begin, end - begin);
+			});
+		}
+		else {
+			visit_slots(p_lists->items.data() + p_lists->start[_m_index],
+				p_lists->count[_m_index]);
+		}
+		const UniformGrid* p_grid = context.p_grid;
+		int cell = p_grid->pack(p_grid->cell_x(position.x), p_grid->cell_y(position.y));
+		for (int k = p_lists->stray_head[cell]; k >= 0; k = p_lists->stray_next[k]) {
+			visit_slots(&p_lists->stray_slot[k], 1);
+		}
+	}
+	else if (context.mode == Flightspace::search_modes::BRUTE_FORCE) {
+		kernel(*p_sorted, 0, p_sorted->size(), position.x, position.y,
+			_m_index, percept, p_row, sums);
+		visits = p_sorted->size();
+	}
+	else {
+		auto visit_row = [&](int begin, int end) {
+			kernel(*p_sorted, begin, end, position.x, position.y,
+				_m_index, percept, p_row, sums);
+			visits += end - begin;
+		};
+		if (SPAN > 0) {
+			context.p_grid->query_rows_span<SPAN>(position.x, position.y, visit_row);
+		}
+		else {
+			context.p_grid->query_rows(position.x, position.y, percept, visit_row);
 		}
 	}
+	rule_visits.neighbors += visits;
+	neighbors = sums.count;
+
 	// Avoidance.
 	Vector2 avoid(0.0, 0.0);
 	Vector2 a_steer(0.0, 0.0);
 
 	// Obstacle looping.
-	// Check if there are obstacles in the local cell.
-	if (p_obs_hash->find(_m_cell) != p_obs_hash->end()) {
-		std::vector<Vector2*>* local_obs = &(p_obs_hash->at(_m_cell));
-		for (auto it : *local_obs) {
-			Vector2* p_obstacle = it;
-			float dist = _m_position.distance_to(*p_obstacle);
-			if (dist < _M_PERCEPT) {
-				a_steer = _m_position - (*p_obstacle);
-				avoid = avoid + a_steer.scaled((_M_PERCEPT - dist) / _M_PERCEPT);
+	auto visit_obstacle = [&](int index) {
+		rule_visits.obstacles++;
+		Vector2 obstacle(p_obstacles->get_x(index), p_obstacles->get_y(index));
+		float dist = position.distance_to(obstacle);
+		if (dist < percept) {
+			a_steer = position - obstacle;
+			avoid = avoid + a_steer.scaled((percept - dist) / percept);
+		}
+	};
+	if (p_obstacles != nullptr) {
+		if (context.mode == Flightspace::search_modes::BRUTE_FORCE) {
+			for (int i = 0; i < p_obstacles->size(); i++) {
+				visit_obstacle(i);
 			}
 		}
+		else {
+			p_obstacles->query(position.x, position.y,
+				percept, visit_obstacle);
+		}
+	}
+
+	// Force fields aren't normalized, their strength is their weight.
+	Vector2 fields(0.0, 0.0);
+	if (context.p_fields != nullptr) {
+		fields = (context.mode == Flightspace::search_modes::BRUTE_FORCE)?
+			context.p_fields->influence_brute(position.x, position.y, rule_visits.fields) :
+			context.p_fields->influence(position.x, position.y, rule_visits.fields);
 	}
 
 	// Vector processing.
-	separate = separate.normalized().scaled(m_separate);
-	avoid = avoid.normalized().scaled(m_avoid);
-	if (align_locals > 0) {
-		// Average
-		align.x /= align_locals;
-		align.y /= align_locals;
-		// Normalize/Scale
-		align = align.normalized().scaled(m_align);
-	}
-	if (cohede_locals > 0) {
-		// Average
-		c_vector.x /= cohede_locals;
-		c_vector.y /= cohede_locals;
-		// Turn the c_vector now into the vector
-		// pointing to what it used to be, the center of mass
-		c_vector = (c_vector - _m_position).normalized().scaled(m_cohede);
-	}
-	return separate + align + c_vector + avoid;
+	// Averaging doesn't change a direction, so alignment is
+	// normalized straight from the sum.
+	fast_normalize(sums.sep_x, sums.sep_y);
+	fast_normalize(sums.align_x, sums.align_y);
+	fast_normalize(avoid.x, avoid.y);
+	const SpeciesRules& rules = p_species->rules[species];
+	Vector2 separate = Vector2(sums.sep_x, sums.sep_y).scaled(m_separate * rules.separate);
+	Vector2 align = Vector2(sums.align_x, sums.align_y).scaled(m_align * rules.align);
+	avoid = avoid.scaled(m_avoid * rules.avoid);
+
+	Vector2 c_vector(0.0, 0.0);
+	if (sums.count > 0) {
+		// Weighted sum of the offsets to the neighbors, with one
+		// species that points at the center of mass. Negative
+		// weights make the neighbor push us away instead.
+		c_vector.x = sums.coh_x - sums.coh_weight * position.x;
+		c_vector.y = sums.coh_y - sums.coh_weight * position.y;
+		fast_normalize(c_vector.x, c_vector.y);
+		c_vector = c_vector.scaled(m_cohede * rules.cohede);
+	}
+	return separate + align + c_vector + avoid + fields;
 }
 
 // Apply the rules of the boids.
-void Boid::apply_rules(boid_hash* p_hash, obs_hash* p_obs_hash) {
-	_m_dir = _m_dir.linear_interpolate(compute(p_hash, p_obs_hash), _m_agility);
-	_m_dir = _m_dir.normalized().scaled(_m_speed);
+template <int SPAN>
+void Boid::apply_rules(const RuleContext& context, FlockData* p_next,
+	RuleVisits& visits) const
+{
+	int neighbors = 0;
+	Vector2 dir = get_direction().linear_interpolate(
+		compute<SPAN>(context, visits, neighbors), get_agility());
+	// Our slot in the next frame.
+	int slot = (context.p_new_slot != nullptr)? context.p_new_slot[_m_index] : _m_index;
+	int id = get_id();
+	fast_normalize(dir.x, dir.y);
+	dir = dir.scaled(get_speed());
+
+	// Move, then wrap around the world edges.
+	Vector2 position = get_pos() + dir;
+	const WorldBounds& bounds = context.bounds;
+	position.x = (position.x < bounds.xmin)? bounds.xmax : position.x;
+	position.x = (position.x > bounds.xmax)? bounds.xmin : position.x;
+	position.y = (position.y < bounds.ymin)? bounds.ymax : position.y;
+	position.y = (position.y > bounds.ymax)? bounds.ymin : position.y;
+
+	p_next->x[slot] = position.x;
+	p_next->y[slot] = position.y;
+	p_next->dx[slot] = dir.x;
+	p_next->dy[slot] = dir.y;
+	p_next->speed[slot] = get_speed();
+	p_next->agility[slot] = get_agility();
+	p_next->species[slot] = _mp_flock->species[_m_index];
+	p_next->neighbors[slot] = neighbors;
+	p_next->id[slot] = id;
+	p_next->slot[id] = slot;
 }
 
 void Boid::move() {
 	// Add the movement vector.
-	_m_position = _m_position + _m_dir;
+	_mp_flock->x[_m_index] += _mp_flock->dx[_m_index];
+	_mp_flock->y[_m_index] += _mp_flock->dy[_m_index];
 }
 
 double Boid::get_rotation() const {
+	Vector2 dir = get_direction();
 	double deg = 0.0;
-	if (_m_dir.x != 0) { deg = atan(_m_dir.y/_m_dir.x) * 57.2958; }
-	if (_m_dir.x < 0) { deg -= 180.0; }
+	if (dir.x != 0) { deg = atan(dir.y/dir.x) * 57.2958; }
+	if (dir.x < 0) { deg -= 180.0; }
 	return deg;
 }
 
 Vector2 Boid::get_pos() const {
-	return _m_position;
+	return Vector2(_mp_flock->x[_m_index], _mp_flock->y[_m_index]);
 }
 
 Vector2 Boid::get_direction() const {
-	return _m_dir;
+	return Vector2(_mp_flock->dx[_m_index], _mp_flock->dy[_m_index]);
+}
+
+float Boid::get_speed() const {
+	return _mp_flock->speed[_m_index];
+}
+
+float Boid::get_agility() const {
+	return _mp_flock->agility[_m_index];
+}
+
+int Boid::get_species() const {
+	return _mp_flock->species[_m_index];
+}
+
+int Boid::get_id() const {
+	return _mp_flock->id[_m_index];
 }
 
-void Boid::set_cell(const std::string& cell) {
-	_m_cell = cell;
+int Boid::get_index() const {
+	return _m_index;
 }
 
 void Boid::set_pos(float x, float y) {
-	_m_position.x = x;
-	_m_position.y = y;
+	_mp_flock->x[_m_index] = x;
+	_mp_flock->y[_m_index] = y;
 }
 
 // Setter functions.
@@ -196,137 +363,706 @@ void Boid::change_behaviour(float separate,
 
 // Binds the boids position to set position.
 void Boid::bind_position(int xmin, int xmax, int ymin, int ymax) {
-	_m_position.x = (_m_position.x < xmin)? xmax : _m_position.x;
-    _m_position.x = (_m_position.x > xmax)? xmin : _m_position.x;
-	_m_position.y = (_m_position.y < ymin)? ymax : _m_position.y;
-	_m_position.y = (_m_position.y > ymax)? ymin : _m_position.y;
+	float& x = _mp_flock->x[_m_index];
+	float& y = _mp_flock->y[_m_index];
+	x = (x < xmin)? xmax : x;
+    x = (x > xmax)? xmin : x;
+	y = (y < ymin)? ymax : y;
+	y = (y > ymax)? ymin : y;
 }
 
 // Member function definitions for Flightspace.
-const float Flightspace::_M_CELLSIZE = 25.0f;
-
 Flightspace::Flightspace() {
-	_mp_boids = new std::vector<Boid*>();
-	_mp_hash = new boid_hash();
-	_mp_obs_hash = new obs_hash();
+	_mp_flock = new FlockData();
+	_mp_next = new FlockData();
+	_m_bounds = {0.0f, 0.0f, 100.0f, 100.0f};
+	// Cells are as wide as the perception radius, so the
+	// cells overlapping a boid's perception are at most 3x3.
+	_m_perception = DEFAULT_PERCEPTION;
+	_m_cellsize = DEFAULT_PERCEPTION;
+	_m_species = uniform_species();
+	_mp_sorted = new NeighborData();
+	_mp_obstacles = nullptr;
+	_mp_fields = nullptr;
+	_mp_grid = new UniformGrid(_m_cellsize);
+	_m_search_mode = search_modes::GRID;
+	_m_kernel_type = best_kernel_type();
+	_m_reorder_interval = 32;
+	_m_frames_to_reorder = 0;
+	_m_tile_size = 0;
+	_m_tile_side = 1;
+	_mp_tile_order = nullptr;
+	_m_num_ordered = 0;
+	_mp_arena = new FrameArena();
+	_mp_thread_arenas = new tbb::enumerable_thread_specific<FrameArena>();
+	_m_skin = 0.0f;
+	_m_lists_valid = false;
+	_m_list_rebuilds = 0;
+	_mp_lists = new NeighborLists();
+	_m_update_times = {0.0, 0.0};
 }
 
 Flightspace::~Flightspace() {
-	_mp_hash->clear(); // Clear our spatial hash
-	_mp_obs_hash->clear();
-
-    // Deletes the hash, but not the boids within the vectors.
-	delete _mp_hash;
-	delete _mp_obs_hash;
+	// Deletes the grid, it only holds indices.
+	delete _mp_grid;
 
 	// Deallocate memory for boids.
-	for (auto boid : *_mp_boids) {
-		delete boid; // Gets the boid pointer.
-	}
-	delete _mp_boids;
+	delete _mp_flock;
+	delete _mp_next;
+	delete _mp_sorted;
+	delete _mp_arena;
+	delete _mp_thread_arenas;
+	delete _mp_lists;
 	// Not deleting _mp_obstacles as that is
-	// supposed to be a pointer to a vector in a obstaclegroup object.
+	// owned by whoever made the obstaclegroup.
+	// Same for _mp_fields.
 }
 
 void Flightspace::random_populate(unsigned int size, int xmax,
-	int ymax, float speed, float agility, float speed_v, float agility_v)
+	int ymax, float speed, float agility, float speed_v, float agility_v,
+	uint64_t seed, uint8_t species)
 {
-	for (int i = 0; i < size; i++) {
-		Vector2 position(randint(0, xmax), randint(0, ymax));
-		Vector2 dir(randint(-1, 1), randint(-1, 1));
+	if (seed == 0) { seed = random_seed(); }
+	// One counter based stream per random quantity,
+	// boid i always takes value i of each stream, so boids
+	// added by a later call don't repeat the earlier ones.
+	enum streams { POS_X, POS_Y, DIR_X, DIR_Y, SPEED, AGILITY, JITTER };
 
-        // Randomize speed and agility
-        float variance_speed = (speed_v/speed)*100.0f; // Speed variance
-        float variance_agil = (agility_v/speed)*100.0f; //
+	// Randomize speed and agility
+	float variance_speed = (speed_v/speed)*100.0f; // Speed variance
+	float variance_agil = (agility_v/speed)*100.0f; //
+
+	int first = _mp_flock->size();
+	_mp_flock->resize(first + size);
+	_m_lists_valid = false;
+	tbb::parallel_for(tbb::blocked_range<int>(0, size),
+	[&](tbb::blocked_range<int> r)
+	{
+		int begin = first + r.begin(), count = r.end() - r.begin();
+		float* xs = &_mp_flock->x[begin];
+		float* ys = &_mp_flock->y[begin];
+		float* dxs = &_mp_flock->dx[begin];
+		float* dys = &_mp_flock->dy[begin];
+		float* speeds = &_mp_flock->speed[begin];
+		float* agilities = &_mp_flock->agility[begin];
+		std::fill_n(&_mp_flock->species[begin], count, species);
 
-        speed += uniform(-variance_speed, variance_speed);
-        agility += uniform(-variance_agil, variance_agil);
+		// Bulk fill, then fix up in place.
+		fill_randint(xs, count, 0, xmax, seed, POS_X, begin);
+		fill_randint(ys, count, 0, ymax, seed, POS_Y, begin);
+		fill_randint(dxs, count, -1, 1, seed, DIR_X, begin);
+		fill_randint(dys, count, -1, 1, seed, DIR_Y, begin);
+		fill_uniform(speeds, count, -variance_speed, variance_speed, seed, SPEED, begin);
+		fill_uniform(agilities, count, -variance_agil, variance_agil, seed, AGILITY, begin);
+		for (int k = 0; k < count; k++) {
+			float boid_speed = speed + speeds[k];
 
-        // Normalize direction and scale the power.
-		dir = dir.normalized().scaled(speed);
+			// Normalize direction and scale the power.
+			Vector2 dir = Vector2(dxs[k], dys[k]).normalized().scaled(boid_speed);
+			dxs[k] = dir.x;
+			dys[k] = dir.y;
 
-        // Instanciate and add the boid.
-        Boid* new_boid = new Boid(position, dir,
-            speed + uniform(-0.25, 0.25), agility);
-		_mp_boids->push_back(new_boid);
-	}
+			speeds[k] = boid_speed + bits_to_uniform(
+				counter_u32(seed, JITTER, begin + k), -0.25, 0.25);
+			agilities[k] += agility;
+		}
+	});
 }
 
-// Probably super inefficient lol.
+// Rebuilds the boid grid. The cell arrays are sized in set_bounds(),
+// so this doesn't allocate unless the flock grew.
+// Obstacles keep their own index up to date as they change.
 void Flightspace::spatial_hash() {
-	// Clear hashes
-	_mp_hash->clear();
-	_mp_obs_hash->clear();
-	std::mutex mtx;
-
-	tbb::parallel_for(tbb::blocked_range<int>(0, _mp_boids->size()),
+	ProfileScope scope("hash");
+	const float* xs = _mp_flock->x.data();
+	const float* ys = _mp_flock->y.data();
+	_mp_grid->resize(_mp_flock->size());
+	tbb::parallel_for(tbb::blocked_range<int>(0, _mp_flock->size()),
 	[&](tbb::blocked_range<int> r)
 	{
 		for (int i = r.begin(); i < r.end(); i++) {
 			// Assign the boid to a cell.
-			Boid* p_boid = _mp_boids->at(i);
-
-			// Find the boid's cell.
-			int x = ceil(p_boid->get_pos().x/_M_CELLSIZE);
-			int y = ceil(p_boid->get_pos().y/_M_CELLSIZE);
-			std::string cell = std::to_string(x) + std::to_string(y);
-			p_boid->set_cell(cell);
-
-			// Insert the boid to the multimap.
-			mtx.lock();
-			// Try and make a new key and value pair.
-			_mp_hash->insert(hash_pair(cell, std::vector<Boid*>()));
-			_mp_hash->at(cell).push_back(p_boid);
-			mtx.unlock();
+			_mp_grid->assign(i, xs[i], ys[i]);
 		}
 	});
+	// Summing each cell in id order keeps the results the same
+	// however the boids are stored.
+	_mp_grid->sort(_mp_flock->id.data());
 
-	tbb::parallel_for(tbb::blocked_range<int>(0, _mp_obstacles->size()),
+	// Gather the flock in cell order so the kernel reads
+	// each row of cells as one contiguous run.
+	const int* items = _mp_grid->get_items();
+	_mp_sorted->resize(_mp_flock->size());
+	tbb::parallel_for(tbb::blocked_range<int>(0, _mp_flock->size()),
 	[&](tbb::blocked_range<int> r)
 	{
-		for (int i = r.begin(); i < r.end(); i++) {
-			// Assign the obstacle to a cell.
-			Vector2* p_vec = _mp_obstacles->at(i);
-
-			// Find the obstacle's cell.
-			int x = ceil(p_vec->x/_M_CELLSIZE);
-			int y = ceil(p_vec->y/_M_CELLSIZE);
-			std::string cell = std::to_string(x) + std::to_string(y);
-
-			// Insert the obstacle to the multimap.
-			mtx.lock();
-			// Try and make a new key and value pair.
-			_mp_obs_hash->insert(obs_pair(cell, std::vector<Vector2*>()));
-			_mp_obs_hash->at(cell).push_back(p_vec);
-			mtx.unlock();
+		for (int s = r.begin(); s < r.end(); s++) {
+			int i = items[s];
+			_mp_sorted->x[s] = xs[i];
+			_mp_sorted->y[s] = ys[i];
+			_mp_sorted->dx[s] = _mp_flock->dx[i];
+			_mp_sorted->dy[s] = _mp_flock->dy[i];
+			_mp_sorted->index[s] = i;
+			_mp_sorted->species[s] = _mp_flock->species[i];
 		}
 	});
 }
 
 void Flightspace::update() {
-	spatial_hash(); // Hash the boids.
+	using clock = std::chrono::steady_clock;
+	auto start = clock::now();
+	// Last update's scratch is done with.
+	_mp_arena->reset();
+	for (FrameArena& arena : *_mp_thread_arenas) {
+		arena.reset();
+	}
+	// Valid lists stand in for the grid, which is left as it was
+	// at the last rebuild. It still lists every slot once, so the
+	// tiles below cover every boid, just with older costs.
+	// Boids that wrapped are told apart from their old place on the
+	// lists by distance alone, which needs a world at least this wide.
+	float min_side = 4.0f * _m_perception + 3.0f * _m_skin;
+	bool use_lists = _m_skin > 0.0f && _m_search_mode == search_modes::GRID &&
+		_m_bounds.xmax - _m_bounds.xmin >= min_side &&
+		_m_bounds.ymax - _m_bounds.ymin >= min_side;
+	bool reuse_lists = use_lists && _m_lists_valid &&
+		(int)_mp_lists->x.size() == _mp_flock->size();
+	if (!reuse_lists) {
+		spatial_hash(); // Hash the boids.
+	}
+	else {
+		prepare_lists();
+	}
+	auto hashed = clock::now();
+
+	const BucketGrid* p_obstacles =
+		(_mp_obstacles != nullptr)? _mp_obstacles->get_index() : nullptr;
+	if (_mp_fields != nullptr) {
+		_mp_fields->update_index();
+	}
+	// Reordering needs a fresh grid, with lists it waits for a rebuild.
+	const int* p_new_slot = nullptr;
+	if (_m_reorder_interval > 0 && --_m_frames_to_reorder <= 0 && !reuse_lists) {
+		p_new_slot = plan_reorder();
+		_m_frames_to_reorder = _m_reorder_interval;
+	}
+	RuleContext context = {_mp_grid, _mp_sorted, p_obstacles, _mp_fields, p_new_slot,
+		reuse_lists? _mp_lists : nullptr, get_kernel(_m_kernel_type),
+		get_slot_kernel(_m_kernel_type), _m_search_mode, _m_bounds, _m_perception,
+		&_m_species};
+	_mp_next->resize(_mp_flock->size());
+
+	// The common neighborhoods get their own copy of the rules
+	// with the query shape known at compile time.
+	int span = _mp_grid->span_for(_m_perception);
+	plan_tiles(span);
+	ProfileScope scope("rules");
+	switch (span) {
+		case 3: run_rules<3>(context); break;
+		case 5: run_rules<5>(context); break;
+		default: run_rules<0>(context); break;
+	}
+	// Lists built now start being used next update, so they
+	// are built around this frame but for the next one's slots.
+	if (use_lists && !reuse_lists) {
+		build_lists(p_new_slot);
+		_m_lists_valid = true;
+		_m_list_rebuilds++;
+	}
+	if (use_lists && lists_outgrown()) {
+		_m_lists_valid = false;
+	}
+	// The next frame becomes the current one.
+	std::swap(_mp_flock, _mp_next);
+
+	auto done = clock::now();
+	_m_update_times.hash_ms =
+		std::chrono::duration<double, std::milli>(hashed - start).count();
+	_m_update_times.rules_ms =
+		std::chrono::duration<double, std::milli>(done - hashed).count();
+}
+
+template <int SPAN>
+void Flightspace::run_rules(const RuleContext& context) {
 	// Use parallel processing for this.
-	tbb::parallel_for(tbb::blocked_range<int>(0, _mp_boids->size()),
+	// Boids only read _mp_flock and only write their own slot
+	// of _mp_next, so scheduling can't change the result.
+	// Moving and wrapping happen in here too.
+	using clock = std::chrono::steady_clock;
+	// Reused lists moved the boids to new slots since the grid was built.
+	const int* items = (context.p_lists != nullptr)?
+		context.p_lists->cell_slots.data() : _mp_grid->get_items();
+	int cols = _mp_grid->get_cols(), rows = _mp_grid->get_rows();
+	std::atomic<int> next_tile(0);
+	// tbb hands the ranges out and steals them between workers, but a
+	// range only says how many tiles to run. Which ones comes from the
+	// shared counter, so tiles start strictly most expensive first.
+	tbb::parallel_for(tbb::blocked_range<int>(0, _m_num_ordered, 1),
 	[&](tbb::blocked_range<int> r)
 	{
-		for (int i = r.begin(); i < r.end(); i++) {
-			// Tell each boid to apply their rules, and pass
-			// the pointer to the spatial hash.
-			_mp_boids->at(i)->apply_rules(_mp_hash, _mp_obs_hash);
+		for (int k = r.begin(); k < r.end(); k++) {
+			auto start = clock::now();
+			TileStats& tile = _m_tiles[_mp_tile_order[
+				next_tile.fetch_add(1, std::memory_order_relaxed)]];
+			int cx_max = std::min(cols, tile.cx + _m_tile_side) - 1;
+			int cy_max = std::min(rows, tile.cy + _m_tile_side) - 1;
+			RuleVisits visits = {0, 0, 0};
+			// A row of the tile's cells is one run of grid slots.
+			for (int cy = tile.cy; cy <= cy_max; cy++) {
+				int begin = _mp_grid->get_cell_start(_mp_grid->pack(tile.cx, cy));
+				int last = _mp_grid->pack(cx_max, cy);
+				int end = _mp_grid->get_cell_start(last) + _mp_grid->get_cell_count(last);
+				for (int s = begin; s < end; s++) {
+					// Tell each boid to apply their rules, and pass
+					// the spatial hash through the context.
+					Boid(_mp_flock, items[s]).apply_rules<SPAN>(context, _mp_next, visits);
+				}
+			}
+			Profiler::get().count(profile_counters::NEIGHBOR_VISITS, visits.neighbors);
+			Profiler::get().count(profile_counters::OBSTACLE_VISITS, visits.obstacles);
+			Profiler::get().count(profile_counters::FIELD_VISITS, visits.fields);
+			tile.thread = tbb::this_task_arena::current_thread_index();
+			tile.ms = std::chrono::duration<float, std::milli>(clock::now() - start).count();
+		}
+	});
+}
+
+// Boids in a cell each check every boid in the span x span
+// cells around it, that product is the tile's estimated work.
+void Flightspace::plan_tiles(int span) {
+	ProfileScope scope("tiles");
+	int cols = _mp_grid->get_cols(), rows = _mp_grid->get_rows();
+	// Enough tiles for the workers to even out, and few enough
+	// that each is a decent run of neighboring boids.
+	_m_tile_side = _m_tile_size;
+	if (_m_tile_side == 0) {
+		int target = 64 * tbb::this_task_arena::max_concurrency();
+		_m_tile_side = std::max(2, (int)std::ceil(std::sqrt((float)cols * rows / target)));
+	}
+	int tile_cols = (cols + _m_tile_side - 1) / _m_tile_side;
+	int tile_rows = (rows + _m_tile_side - 1) / _m_tile_side;
+	int reach = span / 2;
+	_m_tiles.resize(tile_cols * tile_rows);
+	tbb::parallel_for(tbb::blocked_range<int>(0, _m_tiles.size()),
+	[&](tbb::blocked_range<int> r)
+	{
+		int* row_sums = _mp_thread_arenas->local().alloc<int>(
+			(_m_tile_side + 2 * reach) * _m_tile_side);
+		for (int t = r.begin(); t < r.end(); t++) {
+			TileStats& tile = _m_tiles[t];
+			tile = {(t % tile_cols) * _m_tile_side, (t / tile_cols) * _m_tile_side,
+				0, 0.0f, 0.0f, -1};
+			tile.cost = _mp_grid->neighbor_pairs(tile.cx, tile.cy,
+				std::min(cols, tile.cx + _m_tile_side) - 1,
+				std::min(rows, tile.cy + _m_tile_side) - 1,
+				reach, tile.boids, row_sums);
+		}
+	});
+
+	// Empty tiles are skipped, ties go in grid order.
+	_mp_tile_order = _mp_arena->alloc<int>(_m_tiles.size());
+	_m_num_ordered = 0;
+	for (int t = 0; t < (int)_m_tiles.size(); t++) {
+		if (_m_tiles[t].boids > 0) {
+			_mp_tile_order[_m_num_ordered++] = t;
+		}
+	}
+	tbb::parallel_sort(_mp_tile_order, _mp_tile_order + _m_num_ordered, [&](int a, int b) {
+		return (_m_tiles[a].cost != _m_tiles[b].cost)?
+			_m_tiles[a].cost > _m_tiles[b].cost : a < b;
+	});
+}
+
+// The grid already has every cell's boids in one run, so laying
+// the cells out along the curve is a prefix sum and a scatter.
+// Moving the boids is free, update() writes a whole new frame anyway.
+const int* Flightspace::plan_reorder() {
+	ProfileScope scope("reorder");
+	if ((int)_m_curve_cells.size() != _mp_grid->get_num_cells()) {
+		_mp_grid->morton_order(_m_curve_cells);
+	}
+	int num_cells = _m_curve_cells.size();
+	int* curve_start = _mp_arena->alloc<int>(num_cells);
+	int* new_slot = _mp_arena->alloc<int>(_mp_flock->size());
+
+	tbb::parallel_scan(tbb::blocked_range<int>(0, num_cells), 0,
+	[&](tbb::blocked_range<int> r, int total, bool is_final)
+	{
+		for (int k = r.begin(); k < r.end(); k++) {
+			if (is_final) { curve_start[k] = total; }
+			total += _mp_grid->get_cell_count(_m_curve_cells[k]);
+		}
+		return total;
+	}, std::plus<int>());
+
+	const int* items = _mp_grid->get_items();
+	tbb::parallel_for(tbb::blocked_range<int>(0, num_cells),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int k = r.begin(); k < r.end(); k++) {
+			int cell = _m_curve_cells[k];
+			int first = _mp_grid->get_cell_start(cell);
+			int count = _mp_grid->get_cell_count(cell);
+			for (int j = 0; j < count; j++) {
+				new_slot[items[first + j]] = curve_start[k] + j;
+			}
+		}
+	});
+	return new_slot;
+}
+
+// Each list gets room for everything in the cells around its
+// boid, so sizing them needs no distance tests. The fill then
+// writes every candidate and only steps past the ones in reach.
+void Flightspace::build_lists(const int* p_new_slot) {
+	ProfileScope scope("lists");
+	int size = _mp_flock->size();
+	float reach = _m_perception + _m_skin;
+	float reach2 = reach * reach;
+	const float* sorted_x = _mp_sorted->x.data();
+	const float* sorted_y = _mp_sorted->y.data();
+	const int* sorted_index = _mp_sorted->index.data();
+
+	NeighborLists& lists = *_mp_lists;
+	lists.start.resize(size + 1);
+	lists.count.resize(size);
+	lists.x.resize(size);
+	lists.y.resize(size);
+	lists.boids.resize(size);
+	lists.is_stray.assign(size, 0);
+	lists.num_strays = 0;
+	lists.cell_slots.resize(size);
+	lists.stray_reach = _m_perception + 0.5f * _m_skin;
+	// A perception radius touches at most this many cells a side.
+	int side = (int)std::ceil(2.0f * _m_perception / _mp_grid->get_cellsize()) + 1;
+	lists.stray_head.assign(_mp_grid->get_num_cells(), -1);
+	lists.stray_slot.resize(MAX_STRAYS * side * side);
+	lists.stray_next.resize(MAX_STRAYS * side * side);
+	lists.num_links = 0;
+	lists.start[0] = 0;
+	// Boids go in grid order, so neighbors are built next to each other.
+	int* cell_slots = lists.cell_slots.data();
+	tbb::parallel_for(tbb::blocked_range<int>(0, size),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int k = r.begin(); k < r.end(); k++) {
+			int i = sorted_index[k];
+			int slot = (p_new_slot != nullptr)? p_new_slot[i] : i;
+			cell_slots[k] = slot;
+			int room = 0;
+			_mp_grid->query_rows(sorted_x[k], sorted_y[k], reach, [&](int begin, int end) {
+				room += end - begin;
+			});
+			lists.start[slot + 1] = room;
+			lists.x[slot] = sorted_x[k];
+			lists.y[slot] = sorted_y[k];
+		}
+	});
+	tbb::parallel_scan(tbb::blocked_range<int>(1, size + 1), 0,
+	[&](tbb::blocked_range<int> r, int total, bool is_final)
+	{
+		for (int s = r.begin(); s < r.end(); s++) {
+			total += lists.start[s];
+			if (is_final) { lists.start[s] = total; }
+		}
+		return total;
+	}, std::plus<int>());
+
+	// The lists grow as the flock packs tighter, doubling
+	// keeps the reallocations down to a handful in a whole run.
+	int total = lists.start[size];
+	if (total > (int)lists.items.capacity()) {
+		lists.items.reserve(2 * total);
+	}
+	lists.items.resize(total);
+	// The boid itself is in its cells but never kept, so
+	// the last write always lands inside its own room.
+	tbb::parallel_for(tbb::blocked_range<int>(0, size),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int k = r.begin(); k < r.end(); k++) {
+			int slot = cell_slots[k];
+			float x = sorted_x[k], y = sorted_y[k];
+			int* first = lists.items.data() + lists.start[slot];
+			int* out = first;
+			_mp_grid->query_rows(x, y, reach, [&](int begin, int end) {
+				for (int j = begin; j < end; j++) {
+					float ox = x - sorted_x[j], oy = y - sorted_y[j];
+					*out = cell_slots[j];
+					out += (ox*ox + oy*oy < reach2) & (cell_slots[j] != slot);
+				}
+			});
+			lists.count[slot] = out - first;
+		}
+	});
+}
+
+// Next frame's positions against where the lists were built,
+// both are in the next frame's slots. A step over half the world
+// is a wrap, those boids are the strays of the next frame.
+bool Flightspace::lists_outgrown() {
+	NeighborLists& lists = *_mp_lists;
+	float limit = 0.5f * _m_skin;
+	float wrap_x = 0.5f * (_m_bounds.xmax - _m_bounds.xmin);
+	float wrap_y = 0.5f * (_m_bounds.ymax - _m_bounds.ymin);
+	lists.num_strays = 0;
+	return tbb::parallel_reduce(tbb::blocked_range<int>(0, _mp_next->size()), false,
+	[&](tbb::blocked_range<int> r, bool outgrown)
+	{
+		for (int s = r.begin(); s < r.end() && !outgrown; s++) {
+			float ox = _mp_next->x[s] - lists.x[s];
+			float oy = _mp_next->y[s] - lists.y[s];
+			bool wrapped = std::abs(ox) > wrap_x || std::abs(oy) > wrap_y;
+			lists.is_stray[s] = wrapped;
+			if (wrapped) {
+				int stray = lists.num_strays.fetch_add(1, std::memory_order_relaxed);
+				outgrown = stray >= MAX_STRAYS;
+				if (!outgrown) {
+					lists.strays[stray] = s;
+				}
+			}
+			else {
+				outgrown = ox*ox + oy*oy > limit * limit;
+			}
+		}
+		return outgrown;
+	}, [](bool a, bool b) { return a || b; });
+}
+
+// The strays are chained serially, there are only
+// a few of them and a few cells each.
+void Flightspace::prepare_lists() {
+	NeighborLists& lists = *_mp_lists;
+	NeighborData& boids = lists.boids;
+	tbb::parallel_for(tbb::blocked_range<int>(0, _mp_flock->size()),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int s = r.begin(); s < r.end(); s++) {
+			boids.x[s] = _mp_flock->x[s];
+			boids.y[s] = _mp_flock->y[s];
+			boids.dx[s] = _mp_flock->dx[s];
+			boids.dy[s] = _mp_flock->dy[s];
+			boids.species[s] = _mp_flock->species[s];
 		}
 	});
+
+	if (lists.num_links > 0) {
+		std::fill(lists.stray_head.begin(), lists.stray_head.end(), -1);
+		lists.num_links = 0;
+	}
+	int num_strays = lists.num_strays.load(std::memory_order_relaxed);
+	for (int j = 0; j < num_strays; j++) {
+		int slot = lists.strays[j];
+		float x = _mp_flock->x[slot], y = _mp_flock->y[slot];
+		int cx_min = _mp_grid->cell_x(x - _m_perception);
+		int cx_max = _mp_grid->cell_x(x + _m_perception);
+		int cy_min = _mp_grid->cell_y(y - _m_perception);
+		int cy_max = _mp_grid->cell_y(y + _m_perception);
+		for (int cy = cy_min; cy <= cy_max; cy++) {
+			for (int cx = cx_min; cx <= cx_max; cx++) {
+				int cell = _mp_grid->pack(cx, cy);
+				int k = lists.num_links++;
+				lists.stray_slot[k] = slot;
+				lists.stray_next[k] = lists.stray_head[cell];
+				lists.stray_head[cell] = k;
+			}
+		}
+	}
+}
+
+Boid Flightspace::get_boid(int index) const {
+	return Boid(_mp_flock, index);
+}
+
+Boid Flightspace::get_boid_by_id(int id) const {
+	return Boid(_mp_flock, _mp_flock->slot[id]);
 }
 
-Boid* Flightspace::get_boid(int index) const {
-	return _mp_boids->at(index);
+FlockData* Flightspace::get_flock_data() {
+	return _mp_flock;
+}
+
+const FlockData* Flightspace::get_flock_data() const {
+	return _mp_flock;
 }
 
 int Flightspace::get_size() const {
-	return _mp_boids->size();
+	return _mp_flock->size();
+}
+
+UpdateTimes Flightspace::get_update_times() const {
+	return _m_update_times;
 }
 
-void Flightspace::set_obstacles(std::vector<Vector2*>* p_obstacles) {
+void Flightspace::set_obstacles(ObstacleGroup* p_obstacles) {
 	_mp_obstacles = p_obstacles;
+	if (_mp_obstacles != nullptr) {
+		_mp_obstacles->set_cellsize(_m_cellsize);
+		_mp_obstacles->set_bounds(_m_bounds.xmin, _m_bounds.ymin,
+			_m_bounds.xmax, _m_bounds.ymax);
+	}
+}
+
+void Flightspace::set_fields(FieldGroup* p_fields) {
+	_mp_fields = p_fields;
+	if (_mp_fields != nullptr) {
+		_mp_fields->set_bounds(_m_bounds.xmin, _m_bounds.ymin,
+			_m_bounds.xmax, _m_bounds.ymax);
+	}
+}
+
+void Flightspace::set_search_mode(search_modes mode) {
+	_m_search_mode = mode;
+}
+
+Flightspace::search_modes Flightspace::get_search_mode() const {
+	return _m_search_mode;
+}
+
+void Flightspace::set_kernel_type(kernel_types type) {
+	_m_kernel_type = type;
+}
+
+kernel_types Flightspace::get_kernel_type() const {
+	return _m_kernel_type;
+}
+
+void Flightspace::set_reorder_interval(int frames) {
+	_m_reorder_interval = std::max(0, frames);
+	_m_frames_to_reorder = 0;
+}
+
+int Flightspace::get_reorder_interval() const {
+	return _m_reorder_interval;
+}
+
+void Flightspace::set_tile_size(int cells) {
+	_m_tile_size = std::max(0, cells);
+}
+
+int Flightspace::get_tile_size() const {
+	return _m_tile_size;
+}
+
+const std::vector<TileStats>& Flightspace::get_tile_stats() const {
+	return _m_tiles;
+}
+
+void Flightspace::set_neighbor_skin(float skin) {
+	_m_skin = std::max(0.0f, skin);
+	_m_lists_valid = false;
+}
+
+float Flightspace::get_neighbor_skin() const {
+	return _m_skin;
+}
+
+long Flightspace::get_list_rebuilds() const {
+	return _m_list_rebuilds;
+}
+
+void Flightspace::reset_neighbor_lists() {
+	_m_lists_valid = false;
+}
+
+void Flightspace::set_bounds(float xmin, float ymin, float xmax, float ymax) {
+	_m_bounds = {xmin, ymin, xmax, ymax};
+	_mp_grid->set_bounds(xmin, ymin, xmax, ymax);
+	_m_curve_cells.clear();
+	_m_lists_valid = false;
+	if (_mp_obstacles != nullptr) {
+		_mp_obstacles->set_bounds(xmin, ymin, xmax, ymax);
+	}
+	if (_mp_fields != nullptr) {
+		_mp_fields->set_bounds(xmin, ymin, xmax, ymax);
+	}
+}
+
+WorldBounds Flightspace::get_bounds() const {
+	return _m_bounds;
+}
+
+void Flightspace::set_perception(float radius, float cellsize) {
+	_m_perception = radius;
+	_m_cellsize = (cellsize > 0.0f)? std::max(cellsize, radius * MIN_CELL_FRACTION) : radius;
+	_mp_grid->set_cellsize(_m_cellsize);
+	_m_curve_cells.clear();
+	_m_lists_valid = false;
+	// set_cellsize() keeps whole cells, so size from the bounds again.
+	_mp_grid->set_bounds(_m_bounds.xmin, _m_bounds.ymin,
+		_m_bounds.xmax, _m_bounds.ymax);
+	if (_mp_obstacles != nullptr) {
+		_mp_obstacles->set_cellsize(_m_cellsize);
+		_mp_obstacles->set_bounds(_m_bounds.xmin, _m_bounds.ymin,
+			_m_bounds.xmax, _m_bounds.ymax);
+	}
+}
+
+float Flightspace::get_perception() const {
+	return _m_perception;
+}
+
+float Flightspace::get_cellsize() const {
+	return _m_cellsize;
+}
+
+void Flightspace::set_species(const SpeciesTable& table) {
+	_m_species = table;
+	_m_species.count = std::max(1, std::min(MAX_SPECIES, table.count));
+}
+
+const SpeciesTable& Flightspace::get_species() const {
+	return _m_species;
+}
+
+// Counted in doubles, the cell count of a huge world overflows an int.
+bool world_fits(const WorldBounds& bounds, float cellsize) {
+	if (!is_finite(bounds.xmin) || !is_finite(bounds.ymin) ||
+		!is_finite(bounds.xmax) || !is_finite(bounds.ymax) ||
+		!is_finite(cellsize) || cellsize <= 0.0f)
+	{
+		return false;
+	}
+	double width = (double)bounds.xmax - bounds.xmin;
+	double height = (double)bounds.ymax - bounds.ymin;
+	if (width <= 0.0 || height <= 0.0 ||
+		width > MAX_WORLD_SIDE || height > MAX_WORLD_SIDE)
+	{
+		return false;
+	}
+	double cells = std::ceil(width / cellsize) * std::ceil(height / cellsize);
+	return cells <= MAX_GRID_CELLS;
+}
+
+SpeciesTable uniform_species(int count) {
+	SpeciesTable table;
+	table.count = count;
+	for (int a = 0; a < MAX_SPECIES; a++) {
+		table.rules[a] = {1.0f, 1.0f, 1.0f, 1.0f};
+		for (int b = 0; b < MAX_SPECIES; b++) {
+			table.interaction[a].separate[b] = 1.0f;
+			table.interaction[a].align[b] = 1.0f;
+			table.interaction[a].cohede[b] = 1.0f;
+		}
+	}
+	return table;
+}
+
+SpeciesTable predator_prey_species() {
+	enum species { PREY, PREDATOR };
+	SpeciesTable table = uniform_species(2);
+	// Prey keep well away from predators and don't follow them.
+	table.interaction[PREY].separate[PREDATOR] = 4.0f;
+	table.interaction[PREY].align[PREDATOR] = 0.0f;
+	table.interaction[PREY].cohede[PREDATOR] = -6.0f;
+	// Predators head for the prey and hunt alone.
+	table.interaction[PREDATOR].separate[PREY] = 0.0f;
+	table.interaction[PREDATOR].align[PREY] = 0.0f;
+	table.interaction[PREDATOR].cohede[PREY] = 1.0f;
+	table.interaction[PREDATOR].align[PREDATOR] = 0.0f;
+	table.interaction[PREDATOR].cohede[PREDATOR] = 0.0f;
+	table.rules[PREDATOR] = {1.0f, 0.5f, 1.5f, 1.0f};
+	return table;
 }
 
 // Member function definitions for ObstacleGroup
@@ -335,59 +1071,192 @@ ObstacleGroup::ObstacleGroup(float remove_radius,
     _m_max_obstacles(max_obstacles),
 	_m_remove_radius(remove_radius),
 	_m_pack_radius(pack_radius)
-{}
+{
+	// Same cell size as the boid grid, so an avoidance
+	// query is at most 3x3 cells. The flock using us resets it.
+	_mp_index = new BucketGrid(DEFAULT_PERCEPTION);
+}
 
 ObstacleGroup::~ObstacleGroup() {
-	for (int i = 0; i < m_obstacles.size(); i++) {
-		// Calls default destructor on Vector2 pointer.
-		delete m_obstacles[i];
-        m_obstacles.pop_back();
-	}
+	delete _mp_index;
 }
 
 void ObstacleGroup::add_obstacle(float x, float y) {
-	Vector2 add_site(x, y);
-	bool allowed = true;
-	for (int i = 0; i < m_obstacles.size(); i++) {
-		Vector2* p_obstacle = m_obstacles[i];
-		if (add_site.distance_to(*p_obstacle) < _m_pack_radius) {
-			allowed = false;
-		}
-	}
-
 	// If we don't break a packing limit
 	// and we can still add obstacles
-	if (allowed && (m_obstacles.size() < _m_max_obstacles)) {
-		m_obstacles.push_back(new Vector2(x, y));
+	if ((_mp_index->size() < _m_max_obstacles) &&
+		!_mp_index->any_within(x, y, _m_pack_radius))
+	{
+		_mp_index->insert(x, y);
 	}
 }
 
+void ObstacleGroup::add_obstacles(const float* xs, const float* ys, int count) {
+	_mp_index->insert(xs, ys, count);
+}
+
 void ObstacleGroup::remove_obstacles(float x, float y) {
-	Vector2 remove_site(x, y);
-	for (int i = 0; i < m_obstacles.size(); i++) {
-		Vector2* p_obstacle = m_obstacles[i];
-		if (remove_site.distance_to(*p_obstacle) < _m_remove_radius) {
-			// Deallocate memory for the Vector2
-			delete p_obstacle;
-			// Remove the Vector2* itself.
-			m_obstacles.erase(m_obstacles.begin() + i);
-		}
-	}
+	_mp_index->remove_within(x, y, _m_remove_radius);
 }
 
 void ObstacleGroup::clear_all() {
-	// Reverse iterating through the
-	// obstacles and deleting them.
-	for (int i = m_obstacles.size()-1; i >= 0; i--) {
-		delete m_obstacles[i]; // Deallocate
-		m_obstacles.pop_back(); // Remove element.
-	}
+	_mp_index->clear();
+}
+
+void ObstacleGroup::set_bounds(float xmin, float ymin, float xmax, float ymax) {
+	_mp_index->set_bounds(xmin, ymin, xmax, ymax);
+}
+
+void ObstacleGroup::set_cellsize(float cellsize) {
+	_mp_index->set_cellsize(cellsize);
 }
 
 int ObstacleGroup::get_size() const {
-	return m_obstacles.size();
+	return _mp_index->size();
+}
+
+Vector2 ObstacleGroup::get_obstacle(int index) const {
+	return Vector2(_mp_index->get_x(index), _mp_index->get_y(index));
+}
+
+const BucketGrid* ObstacleGroup::get_index() const {
+	return _mp_index;
+}
+
+// Member function definitions for FieldGroup
+FieldGroup::FieldGroup(float cellsize):
+	_m_dirty(false)
+{
+	// Fields are usually wider than a perception radius,
+	// so the cells don't follow the flock's.
+	_mp_index = new CoverGrid(cellsize);
+}
+
+FieldGroup::~FieldGroup() {
+	delete _mp_index;
+}
+
+int FieldGroup::add_point(float x, float y, float radius, float strength,
+	falloffs falloff)
+{
+	return add_flow(x, y, radius, strength, 0.0f, 0.0f, falloff);
+}
+
+int FieldGroup::add_flow(float x, float y, float radius, float strength,
+	float dir_x, float dir_y, falloffs falloff)
+{
+	fast_normalize(dir_x, dir_y);
+	_m_x.push_back(x);
+	_m_y.push_back(y);
+	_m_radius.push_back(radius);
+	_m_strength.push_back(strength);
+	_m_dir_x.push_back(dir_x);
+	_m_dir_y.push_back(dir_y);
+	_m_falloff.push_back(falloff);
+	_m_dirty = true;
+	return get_size() - 1;
+}
+
+void FieldGroup::set_positions(const float* xs, const float* ys) {
+	std::copy(xs, xs + get_size(), _m_x.begin());
+	std::copy(ys, ys + get_size(), _m_y.begin());
+	_m_dirty = true;
+}
+
+void FieldGroup::set_position(int index, float x, float y) {
+	_m_x[index] = x;
+	_m_y[index] = y;
+	_m_dirty = true;
+}
+
+void FieldGroup::clear_all() {
+	_m_x.clear();
+	_m_y.clear();
+	_m_radius.clear();
+	_m_strength.clear();
+	_m_dir_x.clear();
+	_m_dir_y.clear();
+	_m_falloff.clear();
+	_m_dirty = true;
+}
+
+void FieldGroup::set_bounds(float xmin, float ymin, float xmax, float ymax) {
+	_mp_index->set_bounds(xmin, ymin, xmax, ymax);
+	_m_dirty = true;
+}
+
+void FieldGroup::update_index() {
+	if (_m_dirty) {
+		_mp_index->build(_m_x.data(), _m_y.data(), _m_radius.data(), get_size());
+		_m_dirty = false;
+	}
+}
+
+bool FieldGroup::add_influence(int index, float x, float y, Vector2& out) const {
+	float off_x = _m_x[index] - x, off_y = _m_y[index] - y;
+	float dist_sq = off_x*off_x + off_y*off_y;
+	float radius = _m_radius[index];
+	if (dist_sq >= radius*radius) {
+		return false;
+	}
+	float weight = _m_strength[index];
+	float left = 1.0f - std::sqrt(dist_sq) / radius;
+	switch (_m_falloff[index]) {
+		case falloffs::CONSTANT: break;
+		case falloffs::LINEAR: weight *= left; break;
+		case falloffs::QUADRATIC: weight *= left * left; break;
+	}
+	// Flows push along their direction, points pull towards their center.
+	if (is_flow(index)) {
+		out.x += _m_dir_x[index] * weight;
+		out.y += _m_dir_y[index] * weight;
+	}
+	else {
+		fast_normalize(off_x, off_y);
+		out.x += off_x * weight;
+		out.y += off_y * weight;
+	}
+	return true;
+}
+
+Vector2 FieldGroup::influence(float x, float y, long& visits) const {
+	Vector2 out(0.0, 0.0);
+	_mp_index->query_point(x, y, [&](int index) {
+		visits++;
+		add_influence(index, x, y, out);
+	});
+	return out;
+}
+
+Vector2 FieldGroup::influence_brute(float x, float y, long& visits) const {
+	Vector2 out(0.0, 0.0);
+	for (int i = 0; i < get_size(); i++) {
+		add_influence(i, x, y, out);
+	}
+	visits += get_size();
+	return out;
+}
+
+int FieldGroup::get_size() const {
+	return _m_x.size();
+}
+
+Vector2 FieldGroup::get_position(int index) const {
+	return Vector2(_m_x[index], _m_y[index]);
+}
+
+float FieldGroup::get_radius(int index) const {
+	return _m_radius[index];
+}
+
+float FieldGroup::get_strength(int index) const {
+	return _m_strength[index];
+}
+
+bool FieldGroup::is_flow(int index) const {
+	return _m_dir_x[index] != 0.0f || _m_dir_y[index] != 0.0f;
 }
 
-std::vector<Vector2*>* ObstacleGroup::get_obstacles() {
-	return &m_obstacles;
+const CoverGrid* FieldGroup::get_index() const {
+	return _mp_index;
 }
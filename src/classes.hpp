@@ -5,25 +5,29 @@
 #define _CLASSES_H_
 
 // Uses vector.
-#include <SDL2/SDL.h>
+// No SDL in here, the simulation core also builds headless.
 #include <vector>
 #include <string>
-#include <unordered_map>
 #include <cmath>
+#include <cstdint>
+#include <atomic>
 #include <tbb/parallel_for.h>
-#include <mutex>
+#include <tbb/enumerable_thread_specific.h>
+
+// Uses the uniform grid as the spatial index,
+// and the vectorized flocking kernel.
+#include "grid.hpp"
+#include "kernel.hpp"
+#include "arena.hpp"
 
 // Forward declarations of classes.
 class Vector2;
+struct FlockData;
 class Flightspace;
+struct RuleContext;
 class Boid;
 class ObstacleGroup;
-
-// Typedef for our "spatial hash"
-using boid_hash =  std::unordered_map<std::string, std::vector<Boid*>>;
-using hash_pair = std::pair<std::string, std::vector<Boid*>>;
-using obs_hash = std::unordered_map<std::string, std::vector<Vector2*>>;
-using obs_pair = std::pair<std::string, std::vector<Vector2*>>;
+class FieldGroup;
 
 // Simple Vector2 class, we omit the cross/dot product.
 class Vector2 {
@@ -55,6 +59,155 @@ public:
 	Vector2 normalized() const;
 };
 
+// Structure-of-arrays storage for the flock.
+// Each boid is one index into six contiguous float arrays (24 bytes),
+// so neighbor loops stream through memory instead of chasing pointers.
+// The flock may move boids to other slots to keep neighbors close
+// in memory, a boid's id stays the same wherever it is stored.
+struct FlockData {
+	// Positions.
+	std::vector<float> x, y;
+	// Travelling directions.
+	std::vector<float> dx, dy;
+	// Speed and agility (turn speed).
+	std::vector<float> speed, agility;
+	// Species id, below MAX_SPECIES.
+	std::vector<uint8_t> species;
+	// Neighbors within perception the update that made this frame
+	// found for each boid, 0 for boids that weren't updated yet.
+	std::vector<int> neighbors;
+	// Stable id of the boid in each slot, and the slot of each id.
+	std::vector<int> id, slot;
+
+	void push_back(const Vector2& position, const Vector2& dir,
+		float boid_speed, float boid_agility, uint8_t boid_species=0);
+	void reserve(int capacity);
+	// New slots get their own index as their id.
+	void resize(int size);
+	void clear();
+	int size() const;
+	// Makes every boid's id its slot, for data filled in id order.
+	void reset_ids();
+
+	// Copies a per-slot array into out in id order,
+	// for anything that follows boids across frames.
+	template <typename T>
+	void to_id_order(const std::vector<T>& field, std::vector<T>& out) const;
+};
+
+template <typename T>
+void FlockData::to_id_order(const std::vector<T>& field, std::vector<T>& out) const {
+	out.resize(field.size());
+	tbb::parallel_for(tbb::blocked_range<int>(0, field.size()),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int s = r.begin(); s < r.end(); s++) {
+			out[id[s]] = field[s];
+		}
+	});
+}
+
+// Perception radius a flock starts with.
+constexpr float DEFAULT_PERCEPTION = 20.0f;
+// Grid cells are at least this part of the perception radius,
+// a tiny cell size would allocate a huge grid.
+constexpr float MIN_CELL_FRACTION = 0.125f;
+
+// Per-species multipliers of the Boid::m_* strengths.
+struct SpeciesRules {
+	float separate, align, cohede, avoid;
+};
+
+// Rule weights per species, and how each species
+// reacts to neighbors of every species.
+// With a single species every neighbor counts fully,
+// and the kernels skip the per-neighbor weights.
+struct SpeciesTable {
+	int count;
+	SpeciesRules rules[MAX_SPECIES];
+	// interaction[a] is how species a reacts to each species.
+	InteractionRow interaction[MAX_SPECIES];
+};
+
+// count species, all weights 1.
+SpeciesTable uniform_species(int count=1);
+// Species 0 is prey and flees species 1, which chases it.
+SpeciesTable predator_prey_species();
+
+// World rectangle, boids wrap around its edges.
+struct WorldBounds {
+	float xmin, ymin;
+	float xmax, ymax;
+};
+
+// Largest world the loaders take, each side, and the most cells its
+// grids may have. Every grid allocates a few ints per cell, and the
+// 64 pixel render and field grids stay under the cell limit too.
+constexpr float MAX_WORLD_SIDE = 262144.0f;
+constexpr double MAX_GRID_CELLS = 1 << 24;
+
+// Whether bounds are finite, not inverted, no wider than MAX_WORLD_SIDE
+// and split into at most MAX_GRID_CELLS cells of cellsize.
+bool world_fits(const WorldBounds& bounds, float cellsize);
+
+// Wrapped boids the neighbor lists put up with before a rebuild.
+// Each boid only checks the ones chained into its grid cell.
+constexpr int MAX_STRAYS = 256;
+
+// Candidate lists for the neighbor list mode, by slot.
+// Boid s's candidates are the first count[s] slots from items[start[s]],
+// everything that was within perception + skin of it at (x[s], y[s]).
+// The rest of its room, up to start[s + 1], is unused.
+struct NeighborLists {
+	std::vector<int> start;
+	std::vector<int> count;
+	std::vector<int> items;
+	std::vector<float> x, y;
+	// The current frame by slot, what the slot kernel reads.
+	NeighborData boids;
+	// Boids that wrapped around the world edge since the build.
+	// Their own list and their place on the others' are stale, so
+	// they search the grid cells around where they are now, and
+	// the others find them through the cells they're chained into.
+	std::vector<uint8_t> is_stray;
+	int strays[MAX_STRAYS];
+	std::atomic<int> num_strays;
+	// The grid's items as of the build, in the slots the lists use.
+	// Nobody else moved more than skin / 2 since, so a stray finds
+	// every neighbor within perception + skin / 2 of it in the grid.
+	std::vector<int> cell_slots;
+	float stray_reach;
+	// Strays by grid cell, redone every update. Each is chained into
+	// every cell its perception touches: from stray_head[cell],
+	// stray_slot[k] is a stray and stray_next[k] the next link or -1.
+	std::vector<int> stray_head;
+	std::vector<int> stray_slot, stray_next;
+	int num_links;
+};
+
+// Wall-clock time of the phases of the last update(), in milliseconds.
+struct UpdateTimes {
+	double hash_ms;  // Grid rebuild.
+	double rules_ms; // Flocking rules, moving and wrapping.
+};
+
+// One tile of grid cells the rules were run on, from the last update().
+struct TileStats {
+	int cx, cy;   // Top left cell.
+	int boids;
+	float cost;   // Estimated work, boids times the boids around them.
+	float ms;     // Time spent on the tile.
+	int thread;   // Worker that ran it, -1 if the tile was empty.
+};
+
+// Candidates the rules looked at. Summed over a tile,
+// so the profiler is told once per tile instead of per boid.
+struct RuleVisits {
+	long neighbors;
+	long obstacles;
+	long fields;
+};
+
 // Simple Flightspace class.
 // Represents an aggregate of boid objects, and obstacles.
 class Flightspace {
@@ -64,55 +217,213 @@ public:
 	~Flightspace();
 
 	// Populates the flock.
+	// The same non-zero seed always gives the same flock,
+	// a seed of 0 picks a random one.
 	void random_populate(unsigned int size, int xmax=100,
 		int ymax=100, float speed=2.5, float agility=0.1,
-        float speed_v=0.0, float agility_v=0.0);
+        float speed_v=0.0, float agility_v=0.0, uint64_t seed=0,
+		uint8_t species=0);
 
 	// Updates the flock.
+	// Double buffered: every boid reads the previous frame and writes
+	// its new direction and wrapped position into the next one,
+	// so the result is the same for any number of threads.
 	void update();
 
 	// Gets the size of the flock.
 	int get_size() const;
 
-	// Gets a boid at said index.
-	Boid* get_boid(int index = 0) const;
-
-	// Sets the obstacle group.
-	void set_obstacles(std::vector<Vector2*>* p_obstacles);
+	// Phase timings of the last update.
+	UpdateTimes get_update_times() const;
+
+	// Gets a handle to the boid at said index.
+	// Handles only last until the next update, which may move
+	// boids around, keep ids to follow a boid for longer.
+	Boid get_boid(int index = 0) const;
+	Boid get_boid_by_id(int id) const;
+
+	// The current frame's storage, for snapshots.
+	// Call reset_neighbor_lists() after moving boids through it.
+	FlockData* get_flock_data();
+	const FlockData* get_flock_data() const;
+
+	// Sets the obstacle group, its index is queried directly
+	// and takes on our bounds.
+	void set_obstacles(ObstacleGroup* p_obstacles);
+
+	// Sets the force fields, indexed on their own and
+	// rebuilt at the start of each update() they changed in.
+	void set_fields(FieldGroup* p_fields);
+
+	// Sets the world rectangle the grids are sized from,
+	// boids wrap around its edges.
+	void set_bounds(float xmin, float ymin, float xmax, float ymax);
+	WorldBounds get_bounds() const;
+
+	// Sets the perception radius and the cell size of the boid and
+	// obstacle grids, a cellsize of 0 uses the radius. Cells smaller
+	// than MIN_CELL_FRACTION of the radius are made that size.
+	// Keep the cells close to the radius, much smaller cells
+	// fall back to the slower generic neighborhood query.
+	void set_perception(float radius, float cellsize=0.0f);
+	float get_perception() const;
+	float get_cellsize() const;
+
+	// Species weights, ids of our boids have to be below its count.
+	void set_species(const SpeciesTable& table);
+	const SpeciesTable& get_species() const;
+
+	// Neighbor search used by the rules.
+	// BRUTE_FORCE checks every boid and is only a reference for the grid.
+	enum class search_modes { GRID, BRUTE_FORCE };
+	void set_search_mode(search_modes mode);
+	search_modes get_search_mode() const;
+
+	// Flocking kernel, defaults to the best one the CPU supports.
+	void set_kernel_type(kernel_types type);
+	kernel_types get_kernel_type() const;
+
+	// Every this many updates the boids are stored again in
+	// Morton order of their cells, so boids that are close in the
+	// world are close in memory. 0 never reorders. Ids don't change,
+	// and neither do the results, cells are summed in id order.
+	void set_reorder_interval(int frames);
+	int get_reorder_interval() const;
+
+	// The rules run in square tiles of this many cells a side,
+	// most expensive tile first, so a dense clump starts early
+	// instead of holding up the end of the update.
+	// 0 sizes them for about 64 tiles per worker.
+	void set_tile_size(int cells);
+	int get_tile_size() const;
+	// Every tile of the last update, in grid order.
+	const std::vector<TileStats>& get_tile_stats() const;
+
+	// Neighbor list (Verlet) mode. Each boid keeps a list of the
+	// boids within perception + skin, and while no boid has moved
+	// more than skin / 2 since, every neighbor is still on it, so the
+	// grid isn't rebuilt or searched. Slow or dense flocks rebuild
+	// rarely. 0 turns it off, it only applies to the GRID search.
+	void set_neighbor_skin(float skin);
+	float get_neighbor_skin() const;
+	// How many updates rebuilt the lists.
+	long get_list_rebuilds() const;
+	// Rebuilds the lists on the next update.
+	void reset_neighbor_lists();
 private:
 	void spatial_hash();
-	static const float _M_CELLSIZE;
-	std::vector<Boid*>* _mp_boids;
-	std::vector<Vector2*>* _mp_obstacles;
+	// Plans where each boid goes in the next frame, the rules
+	// write them there while moving them. Returns the new slots.
+	const int* plan_reorder();
+	// Sizes the tiles up for a neighborhood of span cells,
+	// and orders them most expensive first.
+	void plan_tiles(int span);
+	// Fills the lists from the grid, already moved to the new slots.
+	void build_lists(const int* p_new_slot);
+	// Whether some boid of the next frame moved too far for the lists,
+	// or more than MAX_STRAYS wrapped. Wrapped boids become strays.
+	bool lists_outgrown();
+	// Copies the current frame out for the slot kernel, and chains
+	// the strays into the grid cells around where they are now.
+	void prepare_lists();
+	// Runs the rules with a compile-time neighborhood span.
+	template <int SPAN>
+	void run_rules(const RuleContext& context);
+	// Current frame, and the one update() writes into.
+	FlockData* _mp_flock;
+	FlockData* _mp_next;
+	WorldBounds _m_bounds;
+	float _m_perception;
+	float _m_cellsize;
+	SpeciesTable _m_species;
+	// Cell-sorted copy of the flock for the kernel.
+	NeighborData* _mp_sorted;
+	ObstacleGroup* _mp_obstacles;
+	FieldGroup* _mp_fields;
+
+	// Uniform grid for the boids, rebuilt every frame.
+	UniformGrid* _mp_grid;
+	// Grid cells along the curve, only redone when the grid changes.
+	std::vector<int> _m_curve_cells;
+	int _m_reorder_interval;
+	int _m_frames_to_reorder;
+	// Tiles, and the non-empty ones by falling cost.
+	// _m_tile_side is the size the last plan_tiles() used.
+	int _m_tile_size;
+	int _m_tile_side;
+	std::vector<TileStats> _m_tiles;
+	int* _mp_tile_order;
+	int _m_num_ordered;
+
+	// Scratch memory that only lives for one update, all of it
+	// freed at the start of the next one. The per-thread arenas
+	// are for scratch taken inside parallel loops.
+	FrameArena* _mp_arena;
+	tbb::enumerable_thread_specific<FrameArena>* _mp_thread_arenas;
+
+	// Neighbor lists.
+	float _m_skin;
+	bool _m_lists_valid;
+	long _m_list_rebuilds;
+	NeighborLists* _mp_lists;
+	search_modes _m_search_mode;
+	kernel_types _m_kernel_type;
+	UpdateTimes _m_update_times;
+};
 
-	// Spatial hashes for obstacles and boids.
-	obs_hash* _mp_obs_hash;
-	boid_hash* _mp_hash;
+// Everything the rules read during one update.
+struct RuleContext {
+	const UniformGrid* p_grid;
+	const NeighborData* p_sorted;
+	const BucketGrid* p_obstacles;
+	const FieldGroup* p_fields;
+	// Where each boid is written in the next frame, null keeps its slot.
+	const int* p_new_slot;
+	// Candidate lists to search instead of the grid, or null.
+	const NeighborLists* p_lists;
+	flock_kernel kernel;
+	slot_kernel list_kernel;
+	Flightspace::search_modes mode;
+	WorldBounds bounds;
+	float perception;
+	const SpeciesTable* p_species;
 };
 
 // Simple Boid class.
+// A lightweight handle to one boid inside a FlockData,
+// it is cheap to copy and holds no state of its own.
 class Boid {
 public:
 	// Constructor (There is no default constructor for this class)
-	Boid(Vector2 position, Vector2 dir,
-		float speed=2.5, float agility=0.1);
+	Boid(FlockData* p_flock, int index);
 	// There is no destructor for this class as
 	// we only need a pointer to the flock for referencing.
 
 	// Member functions.
-	void apply_rules(boid_hash* p_hash, obs_hash* p_obs_hash);
+	// Writes this boid's next direction and moved, wrapped
+	// position into p_next, it doesn't change our own flock.
+	// SPAN is the grid neighborhood in cells, 0 for any size.
+	// Adds the candidates it looked at to visits.
+	template <int SPAN>
+	void apply_rules(const RuleContext& context, FlockData* p_next,
+		RuleVisits& visits) const;
 	void move();
 	double get_rotation() const;
 
 	// Accessor functions.
 	Vector2 get_pos() const;
 	Vector2 get_direction() const;
+	float get_speed() const;
+	float get_agility() const;
+	int get_species() const;
+	int get_index() const;
+	int get_id() const;
 
 	// Setter functions.
-	void set_cell(const std::string& cell);
 	void set_pos(float x, float y);
 
 	// Setter functions, but it sets three data members.
+	// Species weights multiply these.
 	static void change_behaviour(float separate,
 		float align, float cohede, float avoid);
 
@@ -127,47 +438,108 @@ public:
     static float m_cohede;
     static float m_avoid;
 private:
-	// Applies rules to the boid.
-	Vector2 compute(boid_hash* p_hash, obs_hash* p_obs_hash);
-
-	// Constant values for our perception radii.
-	static const int _M_PERCEPT;
-
-	// Speed and agility
-	// (turn speed) of the boid.
-	float _m_speed;
-	float _m_agility;
-
-	// Cell identfier.
-	std::string _m_cell;
-
-	// Two vectors, one for travelling
-	// direction, one for position.
-	Vector2 _m_position;
-	Vector2 _m_dir;
+	// Applies rules to the boid, and counts the neighbors it found.
+	template <int SPAN>
+	Vector2 compute(const RuleContext& context, RuleVisits& visits,
+		int& neighbors) const;
+
+	// The flock we live in, and where.
+	FlockData* _mp_flock;
+	int _m_index;
 };
 
+// Obstacle points, kept in a persistent spatial index.
+// Adding and removing only touch the cells involved,
+// so obstacles that don't change cost nothing per frame.
 class ObstacleGroup {
 public:
 	ObstacleGroup(float remove_radius=50,
 		float pack_radius=5, int max_obstacles=200);
 
-	~ObstacleGroup(); // Deletes all dynamically allocated vector2's.
+	~ObstacleGroup();
+	// Owns its index, so no copies.
+	ObstacleGroup(const ObstacleGroup&) = delete;
+	ObstacleGroup& operator=(const ObstacleGroup&) = delete;
 
 	// Adds a single obstacle at x, y
 	void add_obstacle(float x, float y);
+	// Adds many obstacles at once, for loaded maps.
+	// Skips the pack check, and max_obstacles only limits add_obstacle().
+	void add_obstacles(const float* xs, const float* ys, int count);
 	// Removes obstacles close enough to x, y
 	void remove_obstacles(float x, float y);
 	// Clears all obstacles.
 	void clear_all();
 
+	// Resizes the index, set by the Flightspace using us.
+	void set_bounds(float xmin, float ymin, float xmax, float ymax);
+	void set_cellsize(float cellsize);
+
 	int get_size() const;
-	std::vector<Vector2*>* get_obstacles();
+	Vector2 get_obstacle(int index) const;
+	const BucketGrid* get_index() const;
 private:
 	int _m_max_obstacles;
 	float _m_remove_radius;
 	float _m_pack_radius;
-	std::vector<Vector2*> m_obstacles;
+	// Positions by value, bucketed by cell.
+	BucketGrid* _mp_index;
+};
+
+// How a field weakens towards its radius.
+enum class falloffs : uint8_t { CONSTANT, LINEAR, QUADRATIC };
+
+// Force fields that reach further than a perception radius:
+// points that attract (or repel, with a negative strength) and
+// flows that push everything inside them one way, like wind.
+// They can all move every frame, so the index is rebuilt once per
+// update from the arrays instead of being edited in place.
+class FieldGroup {
+public:
+	FieldGroup(float cellsize=64);
+
+	~FieldGroup();
+
+	// Adds a field and returns its index.
+	int add_point(float x, float y, float radius, float strength,
+		falloffs falloff=falloffs::LINEAR);
+	int add_flow(float x, float y, float radius, float strength,
+		float dir_x, float dir_y, falloffs falloff=falloffs::CONSTANT);
+	// Moves every field at once, xs and ys hold get_size() values.
+	void set_positions(const float* xs, const float* ys);
+	void set_position(int index, float x, float y);
+	void clear_all();
+
+	// Resizes the index, set by the Flightspace using us.
+	void set_bounds(float xmin, float ymin, float xmax, float ymax);
+	// Rebuilds the index if anything changed since the last time.
+	void update_index();
+
+	// Summed push of every field reaching x, y.
+	// Only reads the fields listed in x, y's cell, and
+	// adds how many it looked at to visits.
+	Vector2 influence(float x, float y, long& visits) const;
+	// Same, checking every field, as a reference for the index.
+	Vector2 influence_brute(float x, float y, long& visits) const;
+
+	int get_size() const;
+	Vector2 get_position(int index) const;
+	float get_radius(int index) const;
+	float get_strength(int index) const;
+	bool is_flow(int index) const;
+	const CoverGrid* get_index() const;
+private:
+	// Push of one field on x, y, adds to out.
+	// Returns false if the field doesn't reach that far.
+	bool add_influence(int index, float x, float y, Vector2& out) const;
+
+	// Fields by value, flows have a non-zero direction.
+	std::vector<float> _m_x, _m_y;
+	std::vector<float> _m_radius, _m_strength;
+	std::vector<float> _m_dir_x, _m_dir_y;
+	std::vector<falloffs> _m_falloff;
+	CoverGrid* _mp_index;
+	bool _m_dirty;
 };
 
 #endif
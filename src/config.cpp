@@ -0,0 +1,151 @@
+// Config.cpp
+// Config file loader.
+
+#include "config.hpp"
+#include "rng.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cctype>
+#include <cfloat>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+int SimConfig::get_world_w() const {
+	return (world_w > 0)? world_w : screen_w;
+}
+
+int SimConfig::get_world_h() const {
+	return (world_h > 0)? world_h : screen_h;
+}
+
+WorldBounds SimConfig::get_bounds() const {
+	return {-perception, -perception,
+		get_world_w() + perception, get_world_h() + perception};
+}
+
+// Same rule as Flightspace::set_perception().
+float SimConfig::get_cellsize() const {
+	return (cellsize > 0.0f)? std::max(cellsize, perception * MIN_CELL_FRACTION) : perception;
+}
+
+// Strips spaces and tabs off both ends.
+static std::string trim(const std::string& text) {
+	size_t first = text.find_first_not_of(" \t\r");
+	if (first == std::string::npos) {
+		return "";
+	}
+	size_t last = text.find_last_not_of(" \t\r");
+	return text.substr(first, last - first + 1);
+}
+
+bool parse_whole(const std::string& text, long max, long* p_value) {
+	// strtol() would also take leading spaces and signs.
+	if (text.empty() || !std::isdigit((unsigned char)text[0])) {
+		return false;
+	}
+	char* end = nullptr;
+	errno = 0;
+	long value = std::strtol(text.c_str(), &end, 10);
+	if (*end != '\0' || errno == ERANGE || value > max) {
+		return false;
+	}
+	*p_value = value;
+	return true;
+}
+
+bool parse_real(const std::string& text, double* p_value) {
+	if (text.empty()) {
+		return false;
+	}
+	char* end = nullptr;
+	double value = std::strtod(text.c_str(), &end);
+	if (*end != '\0' || !is_finite(value) || value < 0.0 || value > FLT_MAX) {
+		return false;
+	}
+	*p_value = value;
+	return true;
+}
+
+bool load_config(const std::string& path, SimConfig* p_config) {
+	std::ifstream file(path);
+	if (!file) {
+		std::cout << "Unable to open config file " << path << "\n";
+		return false;
+	}
+
+	std::string line;
+	int line_number = 0;
+	while (std::getline(file, line)) {
+		line_number++;
+		line = trim(line.substr(0, line.find('#')));
+		if (line.empty()) {
+			continue;
+		}
+		size_t equals = line.find('=');
+		std::string key = trim(line.substr(0, equals));
+		std::string text = (equals == std::string::npos)? "" : trim(line.substr(equals + 1));
+
+		// Counts and sizes are whole numbers, the radii and speed may be fractions.
+		long whole = 0;
+		double real = 0.0;
+		bool is_real = (key == "perception" || key == "cellsize" || key == "speed");
+		bool parsed = is_real? parse_real(text, &real) : parse_whole(text, INT_MAX, &whole);
+		if (!parsed) {
+			std::cout << path << ":" << line_number << ": bad value for " << key << "\n";
+			return false;
+		}
+		if (key == "boids") { p_config->boids = whole; }
+		else if (key == "predators") { p_config->predators = whole; }
+		else if (key == "speed") { p_config->speed = real; }
+		else if (key == "perception") { p_config->perception = real; }
+		else if (key == "cellsize") { p_config->cellsize = real; }
+		else if (key == "world_w") { p_config->world_w = whole; }
+		else if (key == "world_h") { p_config->world_h = whole; }
+		else if (key == "screen_w") { p_config->screen_w = whole; }
+		else if (key == "screen_h") { p_config->screen_h = whole; }
+		else if (key == "sim_rate") { p_config->sim_rate = whole; }
+		else {
+			std::cout << path << ":" << line_number << ": unknown key " << key << "\n";
+			return false;
+		}
+	}
+	return check_config(*p_config, path);
+}
+
+bool check_config(const SimConfig& config, const std::string& source) {
+	if (config.perception <= 0.0f || config.speed <= 0.0f || config.sim_rate <= 0 ||
+		config.screen_w <= 0 || config.screen_h <= 0)
+	{
+		std::cout << source << ": perception, speed, sim_rate and the screen size have to be above 0\n";
+		return false;
+	}
+	if (!world_fits(config.get_bounds(), config.get_cellsize())) {
+		std::cout << source << ": a " << config.get_world_w() << "x" << config.get_world_h()
+			<< " world in cells of " << config.get_cellsize() << " is too big, at most "
+			<< (long)MAX_WORLD_SIDE << " a side and " << (long)MAX_GRID_CELLS
+			<< " cells including a perception radius around it\n";
+		return false;
+	}
+	return true;
+}
+
+void apply_config(const SimConfig& config, Flightspace* p_flock) {
+	p_flock->set_perception(config.perception, config.cellsize);
+	WorldBounds bounds = config.get_bounds();
+	p_flock->set_bounds(bounds.xmin, bounds.ymin, bounds.xmax, bounds.ymax);
+	p_flock->set_species((config.predators > 0)?
+		predator_prey_species() : uniform_species());
+}
+
+void populate(const SimConfig& config, Flightspace* p_flock, uint64_t seed) {
+	if (seed == 0) { seed = random_seed(); }
+	p_flock->random_populate(config.boids, config.get_world_w(),
+		config.get_world_h(), config.speed, 0.3, 0.0, 0.0, seed);
+	// Predators are a bit faster, or they'd never catch anything.
+	if (config.predators > 0) {
+		p_flock->random_populate(config.predators, config.get_world_w(),
+			config.get_world_h(), config.speed + 0.75f, 0.2, 0.0, 0.0, seed, 1);
+	}
+}
@@ -0,0 +1,55 @@
+// Config.h
+// Runtime settings for the simulation, read from a plain text file
+// so flock size, perception and world size don't need a rebuild.
+
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#include "classes.hpp"
+#include <string>
+
+// One "key = value" per line, # starts a comment.
+// Keys are the member names below, missing keys keep their defaults.
+struct SimConfig {
+	int boids = 2250;
+	// Extra boids of a second species that hunts the rest.
+	int predators = 0;
+	// Boid speed in pixels per step, predators go 0.75 faster.
+	float speed = 3.25f;
+	// Perception radius, and the grid cell size (0 = same as perception).
+	float perception = DEFAULT_PERCEPTION;
+	float cellsize = 0.0f;
+	// World size, 0 = same as the screen. Boids are spawned
+	// inside it and wrap a perception radius past its edges.
+	int world_w = 0;
+	int world_h = 0;
+	// Window size.
+	int screen_w = 1280;
+	int screen_h = 720;
+	// Flock steps per second.
+	int sim_rate = 60;
+
+	int get_world_w() const;
+	int get_world_h() const;
+	// The wrap rectangle of the world.
+	WorldBounds get_bounds() const;
+	// The grid cell size the flock ends up with.
+	float get_cellsize() const;
+};
+
+// Reads path into p_config, keeping the defaults of missing keys.
+// Returns false if the file can't be opened or has a bad line.
+bool load_config(const std::string& path, SimConfig* p_config);
+// Whether config makes a world that fits, see world_fits().
+// Prints what's wrong with it, prefixed with source.
+bool check_config(const SimConfig& config, const std::string& source);
+// Parse all of text as a number of at most max, or as
+// a finite fraction. Both reject negatives and trailing junk.
+bool parse_whole(const std::string& text, long max, long* p_value);
+bool parse_real(const std::string& text, double* p_value);
+// Applies the perception, bounds and species to a flock.
+void apply_config(const SimConfig& config, Flightspace* p_flock);
+// Spawns the boids and predators inside the world.
+void populate(const SimConfig& config, Flightspace* p_flock, uint64_t seed=0);
+
+#endif
@@ -0,0 +1,573 @@
+// Grid.cpp
+// Member function definitions for CellLayout, UniformGrid, BucketGrid and CoverGrid.
+
+#include "grid.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_scan.h>
+#include <tbb/parallel_sort.h>
+#include <cstdint>
+
+// Member function definitions for CellLayout.
+CellLayout::CellLayout(float cell_size):
+	cellsize(cell_size),
+	xmin(0.0f),
+	ymin(0.0f),
+	cols(1),
+	rows(1)
+{}
+
+void CellLayout::set_bounds(float x_min, float y_min, float x_max, float y_max) {
+	xmin = std::min(x_min, x_max);
+	ymin = std::min(y_min, y_max);
+	cols = std::max(1, (int)std::ceil(std::abs(x_max - x_min) / cellsize));
+	rows = std::max(1, (int)std::ceil(std::abs(y_max - y_min) / cellsize));
+}
+
+void CellLayout::set_cellsize(float cell_size) {
+	float xmax = xmin + cols * cellsize;
+	float ymax = ymin + rows * cellsize;
+	cellsize = cell_size;
+	set_bounds(xmin, ymin, xmax, ymax);
+}
+
+// Clamped while still a float, so a point far outside
+// the world can't overflow the cast to int.
+int CellLayout::cell_x(float x) const {
+	float fx = std::floor((x - xmin) / cellsize);
+	return (fx > 0.0f)? ((fx < cols)? (int)fx : cols - 1) : 0;
+}
+
+int CellLayout::cell_y(float y) const {
+	float fy = std::floor((y - ymin) / cellsize);
+	return (fy > 0.0f)? ((fy < rows)? (int)fy : rows - 1) : 0;
+}
+
+int CellLayout::pack(int cx, int cy) const {
+	return cy * cols + cx;
+}
+
+int CellLayout::cell_of(float x, float y) const {
+	return pack(cell_x(x), cell_y(y));
+}
+
+int CellLayout::num_cells() const {
+	return cols * rows;
+}
+
+UniformGrid::UniformGrid(float cellsize):
+	_m_layout(cellsize)
+{
+	set_bounds(0.0f, 0.0f, 100.0f, 100.0f);
+}
+
+void UniformGrid::set_bounds(float xmin, float ymin, float xmax, float ymax) {
+	_m_layout.set_bounds(xmin, ymin, xmax, ymax);
+	resize_cells();
+}
+
+void UniformGrid::set_cellsize(float cellsize) {
+	_m_layout.set_cellsize(cellsize);
+	resize_cells();
+}
+
+void UniformGrid::resize_cells() {
+	// These only allocate if the cell count grew.
+	// Atomics can't be moved, so the counts are rebuilt instead.
+	int num_cells = _m_layout.num_cells();
+	_m_cell_start.resize(num_cells, 0);
+	if ((int)_m_cell_count.size() < num_cells) {
+		_m_cell_count = std::vector<std::atomic<int>>(num_cells);
+	}
+}
+
+int UniformGrid::cell_x(float x) const {
+	return _m_layout.cell_x(x);
+}
+
+int UniformGrid::cell_y(float y) const {
+	return _m_layout.cell_y(y);
+}
+
+int UniformGrid::pack(int cx, int cy) const {
+	return _m_layout.pack(cx, cy);
+}
+
+int UniformGrid::cell_of(float x, float y) const {
+	return _m_layout.cell_of(x, y);
+}
+
+void UniformGrid::resize(int num_items) {
+	// Same size means no allocation.
+	_m_item_cell.resize(num_items);
+	_m_item_rank.resize(num_items);
+	_m_items.resize(num_items);
+}
+
+void UniformGrid::assign(int item, float x, float y) {
+	_m_item_cell[item] = cell_of(x, y);
+}
+
+// Parallel counting sort of the items by cell.
+// Histogram with atomic counters (each item remembers its slot),
+// prefix sum over the cells, then an independent scatter.
+// The atomics hand out slots in whatever order threads arrive, so
+// each cell is sorted afterwards to keep the layout deterministic.
+void UniformGrid::sort(const int* p_keys) {
+	int num_cells = get_num_cells();
+	int num_items = _m_items.size();
+
+	// Histogram.
+	tbb::parallel_for(tbb::blocked_range<int>(0, num_cells),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int c = r.begin(); c < r.end(); c++) {
+			_m_cell_count[c].store(0, std::memory_order_relaxed);
+		}
+	});
+	tbb::parallel_for(tbb::blocked_range<int>(0, num_items),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int i = r.begin(); i < r.end(); i++) {
+			_m_item_rank[i] = _m_cell_count[_m_item_cell[i]].fetch_add(
+				1, std::memory_order_relaxed);
+		}
+	});
+
+	// Exclusive prefix sum for the cell starts.
+	tbb::parallel_scan(tbb::blocked_range<int>(0, num_cells), 0,
+	[&](tbb::blocked_range<int> r, int total, bool is_final)
+	{
+		for (int c = r.begin(); c < r.end(); c++) {
+			if (is_final) { _m_cell_start[c] = total; }
+			total += _m_cell_count[c].load(std::memory_order_relaxed);
+		}
+		return total;
+	}, std::plus<int>());
+
+	// Scatter, every item already knows its slot.
+	tbb::parallel_for(tbb::blocked_range<int>(0, num_items),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int i = r.begin(); i < r.end(); i++) {
+			_m_items[_m_cell_start[_m_item_cell[i]] + _m_item_rank[i]] = i;
+		}
+	});
+
+	// Ascending key order within each cell.
+	auto less = [p_keys](int a, int b) {
+		return (p_keys != nullptr)? p_keys[a] < p_keys[b] : a < b;
+	};
+	tbb::parallel_for(tbb::blocked_range<int>(0, num_cells),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int c = r.begin(); c < r.end(); c++) {
+			int* first = _m_items.data() + _m_cell_start[c];
+			int count = _m_cell_count[c].load(std::memory_order_relaxed);
+			// Cells are usually tiny, so insertion sort wins there.
+			if (count > 32) {
+				std::sort(first, first + count, less);
+				continue;
+			}
+			for (int k = 1; k < count; k++) {
+				int item = first[k];
+				int j = k - 1;
+				while (j >= 0 && less(item, first[j])) {
+					first[j + 1] = first[j];
+					--j;
+				}
+				first[j + 1] = item;
+			}
+		}
+	});
+}
+
+// Clamping only pulls cells closer together, so a point within
+// radius is never more than ceil(radius / cellsize) cells away.
+int UniformGrid::span_for(float radius) const {
+	return 2 * std::max(1, (int)std::ceil(radius / _m_layout.cellsize)) + 1;
+}
+
+// Spreads the low 16 bits of v out to the even bits.
+static uint32_t spread_bits(uint32_t v) {
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+// The grid usually isn't a power of two wide, so the codes
+// have gaps and the cells are sorted by code instead.
+void UniformGrid::morton_order(std::vector<int>& out) const {
+	std::vector<uint64_t> keys(get_num_cells());
+	for (int cy = 0; cy < _m_layout.rows; cy++) {
+		for (int cx = 0; cx < _m_layout.cols; cx++) {
+			uint64_t code = spread_bits(cx) | (spread_bits(cy) << 1);
+			keys[pack(cx, cy)] = (code << 32) | (uint32_t)pack(cx, cy);
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+	out.resize(keys.size());
+	for (size_t k = 0; k < keys.size(); k++) {
+		out[k] = (int)(keys[k] & 0xFFFFFFFFu);
+	}
+}
+
+// Separable box sum: the items within reach along each row first,
+// then reach rows of those for each cell.
+float UniformGrid::neighbor_pairs(int cx_min, int cy_min, int cx_max, int cy_max,
+	int reach, int& items, int* row_sums) const
+{
+	auto count_at = [&](int cx, int cy) {
+		return _m_cell_count[cy * _m_layout.cols + cx].load(std::memory_order_relaxed);
+	};
+	int width = cx_max - cx_min + 1;
+	int ny_min = std::max(0, cy_min - reach);
+	int ny_max = std::min(_m_layout.rows - 1, cy_max + reach);
+	for (int ny = ny_min; ny <= ny_max; ny++) {
+		// Sliding window along the row.
+		int* sums = &row_sums[(ny - ny_min) * width];
+		int sum = 0;
+		for (int nx = std::max(0, cx_min - reach); nx <= std::min(_m_layout.cols - 1, cx_min + reach); nx++) {
+			sum += count_at(nx, ny);
+		}
+		sums[0] = sum;
+		for (int cx = cx_min + 1; cx <= cx_max; cx++) {
+			if (cx + reach < _m_layout.cols) { sum += count_at(cx + reach, ny); }
+			if (cx - reach - 1 >= 0) { sum -= count_at(cx - reach - 1, ny); }
+			sums[cx - cx_min] = sum;
+		}
+	}
+
+	float pairs = 0.0f;
+	items = 0;
+	for (int cy = cy_min; cy <= cy_max; cy++) {
+		for (int cx = cx_min; cx <= cx_max; cx++) {
+			int count = count_at(cx, cy);
+			if (count == 0) {
+				continue;
+			}
+			int nearby = 0;
+			for (int ny = std::max(ny_min, cy - reach); ny <= std::min(ny_max, cy + reach); ny++) {
+				nearby += row_sums[(ny - ny_min) * width + (cx - cx_min)];
+			}
+			items += count;
+			pairs += (float)count * nearby;
+		}
+	}
+	return pairs;
+}
+
+int UniformGrid::get_cell_start(int cell) const {
+	return _m_cell_start[cell];
+}
+
+int UniformGrid::get_cell_count(int cell) const {
+	return _m_cell_count[cell].load(std::memory_order_relaxed);
+}
+
+int UniformGrid::get_item_cell(int item) const {
+	return _m_item_cell[item];
+}
+
+const int* UniformGrid::get_items() const {
+	return _m_items.data();
+}
+
+int UniformGrid::get_cols() const {
+	return _m_layout.cols;
+}
+
+int UniformGrid::get_rows() const {
+	return _m_layout.rows;
+}
+
+int UniformGrid::get_num_cells() const {
+	return _m_layout.num_cells();
+}
+
+float UniformGrid::get_cellsize() const {
+	return _m_layout.cellsize;
+}
+
+float UniformGrid::get_xmin() const {
+	return _m_layout.xmin;
+}
+
+float UniformGrid::get_ymin() const {
+	return _m_layout.ymin;
+}
+
+// Member function definitions for BucketGrid.
+BucketGrid::BucketGrid(float cellsize):
+	_m_layout(cellsize)
+{
+	set_bounds(0.0f, 0.0f, 100.0f, 100.0f);
+}
+
+void BucketGrid::set_bounds(float xmin, float ymin, float xmax, float ymax) {
+	_m_layout.set_bounds(xmin, ymin, xmax, ymax);
+	rebucket();
+}
+
+void BucketGrid::set_cellsize(float cellsize) {
+	_m_layout.set_cellsize(cellsize);
+	rebucket();
+}
+
+// Refills every bucket, only done when the layout changes.
+void BucketGrid::rebucket() {
+	_m_buckets.assign(_m_layout.num_cells(), std::vector<int>());
+	for (int i = 0; i < size(); i++) {
+		_m_item_cell[i] = cell_of(_m_x[i], _m_y[i]);
+		_m_buckets[_m_item_cell[i]].push_back(i);
+	}
+}
+
+int BucketGrid::cell_x(float x) const {
+	return _m_layout.cell_x(x);
+}
+
+int BucketGrid::cell_y(float y) const {
+	return _m_layout.cell_y(y);
+}
+
+int BucketGrid::pack(int cx, int cy) const {
+	return _m_layout.pack(cx, cy);
+}
+
+int BucketGrid::cell_of(float x, float y) const {
+	return _m_layout.cell_of(x, y);
+}
+
+int BucketGrid::insert(float x, float y) {
+	int item = size();
+	int cell = cell_of(x, y);
+	_m_x.push_back(x);
+	_m_y.push_back(y);
+	_m_item_cell.push_back(cell);
+	_m_buckets[cell].push_back(item);
+	return item;
+}
+
+// The new items are sorted by cell first, so items sharing
+// a cell also sit next to each other in the position arrays.
+void BucketGrid::insert(const float* xs, const float* ys, int count) {
+	if (count <= 0) {
+		return;
+	}
+	// Cell in the high bits and source index in the low bits,
+	// so equal cells keep their file order.
+	std::vector<uint64_t> keys(count);
+	tbb::parallel_for(tbb::blocked_range<int>(0, count),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int k = r.begin(); k < r.end(); k++) {
+			keys[k] = ((uint64_t)cell_of(xs[k], ys[k]) << 32) | (uint32_t)k;
+		}
+	});
+	tbb::parallel_sort(keys.begin(), keys.end());
+
+	int first = size();
+	_m_x.resize(first + count);
+	_m_y.resize(first + count);
+	_m_item_cell.resize(first + count);
+	tbb::parallel_for(tbb::blocked_range<int>(0, count),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int k = r.begin(); k < r.end(); k++) {
+			int source = (int)(keys[k] & 0xFFFFFFFFu);
+			_m_x[first + k] = xs[source];
+			_m_y[first + k] = ys[source];
+			_m_item_cell[first + k] = (int)(keys[k] >> 32);
+		}
+	});
+	for (int k = 0; k < count; k++) {
+		_m_buckets[_m_item_cell[first + k]].push_back(first + k);
+	}
+}
+
+int BucketGrid::remove_within(float x, float y, float radius) {
+	std::vector<int> doomed;
+	query(x, y, radius, [&](int item) {
+		float off_x = _m_x[item] - x, off_y = _m_y[item] - y;
+		if (off_x*off_x + off_y*off_y < radius*radius) {
+			doomed.push_back(item);
+		}
+	});
+	// Highest index first, so moving the last item
+	// down never moves one we still have to remove.
+	std::sort(doomed.begin(), doomed.end(), std::greater<int>());
+	for (int item : doomed) {
+		erase(item);
+	}
+	return doomed.size();
+}
+
+bool BucketGrid::any_within(float x, float y, float radius) const {
+	bool found = false;
+	query(x, y, radius, [&](int item) {
+		float off_x = _m_x[item] - x, off_y = _m_y[item] - y;
+		found = found || (off_x*off_x + off_y*off_y < radius*radius);
+	});
+	return found;
+}
+
+// Swap and pop, the last item takes over the erased index.
+void BucketGrid::erase(int item) {
+	std::vector<int>& bucket = _m_buckets[_m_item_cell[item]];
+	*std::find(bucket.begin(), bucket.end(), item) = bucket.back();
+	bucket.pop_back();
+
+	int last = size() - 1;
+	if (item != last) {
+		std::vector<int>& last_bucket = _m_buckets[_m_item_cell[last]];
+		*std::find(last_bucket.begin(), last_bucket.end(), last) = item;
+		_m_x[item] = _m_x[last];
+		_m_y[item] = _m_y[last];
+		_m_item_cell[item] = _m_item_cell[last];
+	}
+	_m_x.pop_back();
+	_m_y.pop_back();
+	_m_item_cell.pop_back();
+}
+
+void BucketGrid::reserve(int capacity) {
+	_m_x.reserve(capacity);
+	_m_y.reserve(capacity);
+	_m_item_cell.reserve(capacity);
+}
+
+void BucketGrid::clear() {
+	_m_x.clear();
+	_m_y.clear();
+	_m_item_cell.clear();
+	for (std::vector<int>& bucket : _m_buckets) {
+		bucket.clear();
+	}
+}
+
+int BucketGrid::size() const {
+	return _m_x.size();
+}
+
+float BucketGrid::get_x(int item) const {
+	return _m_x[item];
+}
+
+float BucketGrid::get_y(int item) const {
+	return _m_y[item];
+}
+
+const float* BucketGrid::get_xs() const {
+	return _m_x.data();
+}
+
+const float* BucketGrid::get_ys() const {
+	return _m_y.data();
+}
+
+int BucketGrid::get_cols() const {
+	return _m_layout.cols;
+}
+
+int BucketGrid::get_rows() const {
+	return _m_layout.rows;
+}
+
+float BucketGrid::get_cellsize() const {
+	return _m_layout.cellsize;
+}
+
+// Member function definitions for CoverGrid.
+CoverGrid::CoverGrid(float cellsize):
+	_m_layout(cellsize)
+{
+	set_bounds(0.0f, 0.0f, 100.0f, 100.0f);
+}
+
+void CoverGrid::set_bounds(float xmin, float ymin, float xmax, float ymax) {
+	_m_layout.set_bounds(xmin, ymin, xmax, ymax);
+	clear_cells();
+}
+
+void CoverGrid::set_cellsize(float cellsize) {
+	_m_layout.set_cellsize(cellsize);
+	clear_cells();
+}
+
+void CoverGrid::clear_cells() {
+	_m_cell_start.assign(_m_layout.num_cells() + 1, 0);
+	_m_entries.clear();
+}
+
+int CoverGrid::cell_x(float x) const {
+	return _m_layout.cell_x(x);
+}
+
+int CoverGrid::cell_y(float y) const {
+	return _m_layout.cell_y(y);
+}
+
+int CoverGrid::pack(int cx, int cy) const {
+	return _m_layout.pack(cx, cy);
+}
+
+// Counting sort again, but an item lands in every cell of its
+// bounding square. Two passes over the same cell ranges: count, then fill.
+void CoverGrid::build(const float* xs, const float* ys, const float* radii, int count) {
+	int num_cells = _m_layout.num_cells();
+	_m_cell_start.assign(num_cells + 1, 0);
+	auto for_each_cell = [&](int item, auto visit) {
+		int cx_min = cell_x(xs[item] - radii[item]), cx_max = cell_x(xs[item] + radii[item]);
+		int cy_min = cell_y(ys[item] - radii[item]), cy_max = cell_y(ys[item] + radii[item]);
+		for (int cy = cy_min; cy <= cy_max; cy++) {
+			for (int cx = cx_min; cx <= cx_max; cx++) {
+				visit(pack(cx, cy));
+			}
+		}
+	};
+
+	// Counts go one slot up, so the prefix sum leaves the starts in place.
+	for (int i = 0; i < count; i++) {
+		for_each_cell(i, [&](int cell) { _m_cell_start[cell + 1]++; });
+	}
+	for (int c = 0; c < num_cells; c++) {
+		_m_cell_start[c + 1] += _m_cell_start[c];
+	}
+
+	// Fill, using the starts as write cursors and shifting them back after.
+	// Fields move every frame, so leave room for a few more entries.
+	int entries = _m_cell_start[num_cells];
+	if (entries > (int)_m_entries.capacity()) {
+		_m_entries.reserve(entries + entries / 4);
+	}
+	_m_entries.resize(entries);
+	for (int i = 0; i < count; i++) {
+		for_each_cell(i, [&](int cell) { _m_entries[_m_cell_start[cell]++] = i; });
+	}
+	for (int c = num_cells; c > 0; c--) {
+		_m_cell_start[c] = _m_cell_start[c - 1];
+	}
+	_m_cell_start[0] = 0;
+}
+
+int CoverGrid::get_cols() const {
+	return _m_layout.cols;
+}
+
+int CoverGrid::get_rows() const {
+	return _m_layout.rows;
+}
+
+float CoverGrid::get_cellsize() const {
+	return _m_layout.cellsize;
+}
+
+int CoverGrid::get_num_entries() const {
+	return _m_entries.size();
+}
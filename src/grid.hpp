@@ -0,0 +1,317 @@
+// Grid.h
+// Uniform grids used as the spatial indices for boids, obstacles and fields.
+
+#ifndef _GRID_H_
+#define _GRID_H_
+
+#include <vector>
+#include <atomic>
+
+// Square cells covering a world rectangle, the layout all the grids share.
+// Cell (cx, cy) has its top left corner at
+// (xmin + cx * cellsize, ymin + cy * cellsize).
+struct CellLayout {
+	float cellsize;
+	float xmin, ymin;
+	int cols, rows;
+
+	CellLayout(float cell_size);
+	// Covers the rectangle with whole cells, at least one each way.
+	void set_bounds(float x_min, float y_min, float x_max, float y_max);
+	// Keeps the covered rectangle, in cells of the new size.
+	void set_cellsize(float cell_size);
+
+	// Cell coordinates, clamped into the grid so
+	// points outside the bounds land on the border cells.
+	int cell_x(float x) const;
+	int cell_y(float y) const;
+	// Packs cell coordinates into a flat cell index.
+	int pack(int cx, int cy) const;
+	int cell_of(float x, float y) const;
+	int num_cells() const;
+};
+
+// Flat uniform grid over a fixed world rectangle.
+// Items (boids, obstacles) are referenced by index. Every rebuild
+// sorts the item indices by cell so each cell is one contiguous
+// [start, start + count) range of get_items().
+// The rebuild is a lock-free parallel counting sort, assign() may
+// be called from many threads as long as each item is only written once.
+class UniformGrid {
+public:
+	UniformGrid(float cellsize=25.0f);
+
+	// Sizes the cell array from the world bounds.
+	// Only reallocates when the number of cells changes.
+	void set_bounds(float xmin, float ymin, float xmax, float ymax);
+	void set_cellsize(float cellsize);
+
+	// Cell coordinates, clamped into the grid so
+	// items outside the bounds land on the border cells.
+	int cell_x(float x) const;
+	int cell_y(float y) const;
+	// Packs cell coordinates into a flat cell index.
+	int pack(int cx, int cy) const;
+	int cell_of(float x, float y) const;
+
+	// Rebuilding.
+	// Call resize() with the item count, assign() every item,
+	// then sort() to fill the per-cell ranges.
+	// Items in a cell are in ascending order of p_keys[item],
+	// or of item without keys.
+	void resize(int num_items);
+	void assign(int item, float x, float y);
+	void sort(const int* p_keys=nullptr);
+
+	// Visits every item in the cells overlapping the square
+	// around (x, y) with half-width radius. With a cell size of at
+	// least radius this is at most the 3x3 neighborhood.
+	// Visitor is called as visit(item) and must do its own distance check.
+	template <typename Visitor>
+	void query(float x, float y, float radius, Visitor visit) const;
+
+	// Same cells as query(), but a row of neighboring cells is one
+	// contiguous run of sorted slots, so visit(begin, end) is called
+	// once per row with a [begin, end) slot range into get_items().
+	template <typename Visitor>
+	void query_rows(float x, float y, float radius, Visitor visit) const;
+	// Same, for every cell overlapping a rectangle.
+	template <typename Visitor>
+	void query_rect(float xmin, float ymin, float xmax, float ymax, Visitor visit) const;
+
+	// query_rows() with the neighborhood fixed at compile time to
+	// SPAN x SPAN cells around the cell of (x, y). Only valid while
+	// radius <= cellsize * (SPAN - 1) / 2, see span_for().
+	template <int SPAN, typename Visitor>
+	void query_rows_span(float x, float y, Visitor visit) const;
+	// Smallest odd span that covers radius with our cell size.
+	int span_for(float radius) const;
+	// Every cell, in the order a Morton (Z-order) curve visits them.
+	void morton_order(std::vector<int>& out) const;
+	// Work estimate of a query over the cells [cx_min, cx_max] x
+	// [cy_min, cy_max]: every item there times the items within reach
+	// cells of its own. Also counts those items into items.
+	// row_sums is scratch space for (height + 2 * reach) * width ints.
+	float neighbor_pairs(int cx_min, int cy_min, int cx_max, int cy_max,
+		int reach, int& items, int* row_sums) const;
+
+	// Accessors.
+	int get_cell_start(int cell) const;
+	int get_cell_count(int cell) const;
+	int get_item_cell(int item) const;
+	const int* get_items() const;
+	int get_cols() const;
+	int get_rows() const;
+	int get_num_cells() const;
+	float get_cellsize() const;
+	// Top left corner of cell (0, 0).
+	float get_xmin() const;
+	float get_ymin() const;
+private:
+	// Sizes the cell arrays after the layout changed.
+	void resize_cells();
+
+	CellLayout _m_layout;
+
+	// Per-cell ranges into _m_items.
+	// The counts are atomic so the histogram needs no mutex.
+	std::vector<int> _m_cell_start;
+	std::vector<std::atomic<int>> _m_cell_count;
+
+	// Cell index and slot within that cell per item,
+	// and item indices sorted by cell.
+	std::vector<int> _m_item_cell;
+	std::vector<int> _m_item_rank;
+	std::vector<int> _m_items;
+};
+
+// Uniform grid with a bucket of item indices per cell, updated
+// one item at a time instead of rebuilt. Meant for things that
+// rarely move, like obstacles, so they cost nothing per frame.
+// Positions are stored by value in two contiguous arrays and item
+// indices are 0..size()-1, removing an item moves the last one into its slot.
+class BucketGrid {
+public:
+	BucketGrid(float cellsize=25.0f);
+
+	// Same cell layout as UniformGrid, changing it rebuckets every item.
+	void set_bounds(float xmin, float ymin, float xmax, float ymax);
+	void set_cellsize(float cellsize);
+
+	int cell_x(float x) const;
+	int cell_y(float y) const;
+	int pack(int cx, int cy) const;
+	int cell_of(float x, float y) const;
+
+	// Adds an item and returns its index.
+	int insert(float x, float y);
+	// Adds count items at once, appended in cell order.
+	void insert(const float* xs, const float* ys, int count);
+	// Removes every item closer than radius to (x, y).
+	// Returns how many were removed.
+	int remove_within(float x, float y, float radius);
+	// Whether any item is closer than radius to (x, y).
+	bool any_within(float x, float y, float radius) const;
+	void reserve(int capacity);
+	void clear();
+
+	// Visits every item in the cells overlapping the square
+	// around (x, y), see UniformGrid::query().
+	template <typename Visitor>
+	void query(float x, float y, float radius, Visitor visit) const;
+	// Same, for every cell overlapping a rectangle.
+	template <typename Visitor>
+	void query_rect(float xmin, float ymin, float xmax, float ymax, Visitor visit) const;
+
+	// Accessors.
+	int size() const;
+	float get_x(int item) const;
+	float get_y(int item) const;
+	const float* get_xs() const;
+	const float* get_ys() const;
+	int get_cols() const;
+	int get_rows() const;
+	float get_cellsize() const;
+private:
+	void erase(int item);
+	void rebucket();
+
+	CellLayout _m_layout;
+
+	// Positions, and the cell each item is in.
+	std::vector<float> _m_x, _m_y;
+	std::vector<int> _m_item_cell;
+	// Item indices per cell.
+	std::vector<std::vector<int>> _m_buckets;
+};
+
+// Uniform grid where each item is a disc, listed in every cell its
+// disc overlaps. Building costs more than UniformGrid, but a point
+// query only reads the one cell the point is in, whatever the radii.
+// Meant for things with a reach of their own, like force fields.
+class CoverGrid {
+public:
+	CoverGrid(float cellsize=50.0f);
+
+	void set_bounds(float xmin, float ymin, float xmax, float ymax);
+	void set_cellsize(float cellsize);
+
+	int cell_x(float x) const;
+	int cell_y(float y) const;
+	int pack(int cx, int cy) const;
+
+	// Rebuilds from count discs, reusing the arrays.
+	void build(const float* xs, const float* ys, const float* radii, int count);
+
+	// Visits every item whose disc overlaps the cell of (x, y),
+	// visit(item) must do its own distance check.
+	template <typename Visitor>
+	void query_point(float x, float y, Visitor visit) const;
+
+	// Accessors.
+	int get_cols() const;
+	int get_rows() const;
+	float get_cellsize() const;
+	// Cell entries, one per item and overlapped cell.
+	int get_num_entries() const;
+private:
+	// Empties the cells after the layout changed, until the next build().
+	void clear_cells();
+
+	CellLayout _m_layout;
+
+	// Cell c owns _m_entries[_m_cell_start[c], _m_cell_start[c + 1]).
+	std::vector<int> _m_cell_start;
+	std::vector<int> _m_entries;
+};
+
+template <typename Visitor>
+void UniformGrid::query(float x, float y, float radius, Visitor visit) const {
+	// Clamping is monotonic, so items clamped onto the border
+	// cells are still found.
+	int cx_min = cell_x(x - radius), cx_max = cell_x(x + radius);
+	int cy_min = cell_y(y - radius), cy_max = cell_y(y + radius);
+	for (int cy = cy_min; cy <= cy_max; cy++) {
+		for (int cx = cx_min; cx <= cx_max; cx++) {
+			int cell = pack(cx, cy);
+			const int* p_items = _m_items.data() + _m_cell_start[cell];
+			int count = _m_cell_count[cell].load(std::memory_order_relaxed);
+			for (int k = 0; k < count; k++) {
+				visit(p_items[k]);
+			}
+		}
+	}
+}
+
+template <typename Visitor>
+void UniformGrid::query_rows(float x, float y, float radius, Visitor visit) const {
+	query_rect(x - radius, y - radius, x + radius, y + radius, visit);
+}
+
+template <typename Visitor>
+void UniformGrid::query_rect(float xmin, float ymin,
+	float xmax, float ymax, Visitor visit) const
+{
+	int cx_min = cell_x(xmin), cx_max = cell_x(xmax);
+	int cy_min = cell_y(ymin), cy_max = cell_y(ymax);
+	for (int cy = cy_min; cy <= cy_max; cy++) {
+		int first = pack(cx_min, cy), last = pack(cx_max, cy);
+		int begin = _m_cell_start[first];
+		int end = _m_cell_start[last] +
+			_m_cell_count[last].load(std::memory_order_relaxed);
+		if (begin < end) { visit(begin, end); }
+	}
+}
+
+template <int SPAN, typename Visitor>
+void UniformGrid::query_rows_span(float x, float y, Visitor visit) const {
+	// One cell lookup instead of four, and a fixed trip count.
+	const int half = SPAN / 2;
+	int cx = cell_x(x), cy = cell_y(y);
+	int cx_min = (cx - half < 0)? 0 : cx - half;
+	int cx_max = (cx + half >= _m_layout.cols)? _m_layout.cols - 1 : cx + half;
+	for (int row = -half; row <= half; row++) {
+		int cy_row = cy + row;
+		if (cy_row < 0 || cy_row >= _m_layout.rows) {
+			continue;
+		}
+		int first = pack(cx_min, cy_row), last = pack(cx_max, cy_row);
+		int begin = _m_cell_start[first];
+		int end = _m_cell_start[last] +
+			_m_cell_count[last].load(std::memory_order_relaxed);
+		if (begin < end) { visit(begin, end); }
+	}
+}
+
+template <typename Visitor>
+void BucketGrid::query(float x, float y, float radius, Visitor visit) const {
+	query_rect(x - radius, y - radius, x + radius, y + radius, visit);
+}
+
+template <typename Visitor>
+void BucketGrid::query_rect(float xmin, float ymin,
+	float xmax, float ymax, Visitor visit) const
+{
+	if (_m_x.empty()) {
+		return;
+	}
+	int cx_min = cell_x(xmin), cx_max = cell_x(xmax);
+	int cy_min = cell_y(ymin), cy_max = cell_y(ymax);
+	for (int cy = cy_min; cy <= cy_max; cy++) {
+		for (int cx = cx_min; cx <= cx_max; cx++) {
+			for (int item : _m_buckets[pack(cx, cy)]) {
+				visit(item);
+			}
+		}
+	}
+}
+
+template <typename Visitor>
+void CoverGrid::query_point(float x, float y, Visitor visit) const {
+	int cell = pack(cell_x(x), cell_y(y));
+	for (int k = _m_cell_start[cell]; k < _m_cell_start[cell + 1]; k++) {
+		visit(_m_entries[k]);
+	}
+}
+
+#endif
@@ -0,0 +1,504 @@
+// Headless.cpp
+// Runs the simulation without a window, renderer or any assets,
+// for machines that only have to crunch boids.
+
+// Only uses the simulation core.
+#include "classes.hpp"
+#include "config.hpp"
+#include "obstacles.hpp"
+#include "snapshot.hpp"
+#include "recorder.hpp"
+#include "profiler.hpp"
+#include "rng.hpp"
+#include "alloccount.hpp"
+#include <tbb/global_control.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <climits>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Command line options.
+struct HeadlessOptions {
+	// Flock size, perception and world size.
+	SimConfig config;
+	int frames = 600;
+	int threads = 0; // 0 = let tbb decide.
+	long seed = 0; // 0 = random.
+	int fields = 0; // Moving attractors and repulsors.
+	int reorder = 32; // Frames between Morton reorders, 0 = never.
+	int tile_size = 0; // Cells per tile side for the rules, 0 = auto.
+	float skin = 0.0f; // Neighbor list skin, 0 = search the grid every frame.
+	Flightspace::search_modes search = Flightspace::search_modes::GRID;
+	int verify = 0; // Frames to check against brute force, 0 = a normal run.
+	std::string obstacles; // Obstacle file, none if empty.
+	std::string save_obstacles; // Binary obstacle file written after the run.
+	std::string load; // Snapshot to start from instead of a random flock.
+	std::string save; // Snapshot written after the last frame.
+	std::string record; // Trajectory file, every frame's positions.
+	// Frames of the trajectory read back and checked after the run.
+	int check_first = 0;
+	int check_count = 0;
+	std::string trace; // Chrome trace of the last frames.
+	bool quiet = false;
+};
+
+void print_usage(const char* exec);
+bool parse_args(int argc, char* args[], HeadlessOptions& options);
+void print_tile_summary(const Flightspace& flock);
+
+// Fields that circle around fixed anchors, so the
+// field index has to be rebuilt every frame.
+struct DriftingFields {
+	std::vector<float> anchor_x, anchor_y, phase;
+	std::vector<float> xs, ys;
+
+	void spawn(int count, const SimConfig& config, uint64_t seed, FieldGroup* p_fields);
+	void move(int frame, FieldGroup* p_fields);
+};
+
+bool check_record(const std::string& path, int first,
+	const std::vector<std::vector<float>>& xs, const std::vector<std::vector<float>>& ys);
+bool verify_search(Flightspace& flock, ObstacleGroup* p_obstacles, FieldGroup* p_fields,
+	DriftingFields& drifting, int frames, bool quiet);
+
+int main(int argc, char* args[]) {
+	HeadlessOptions options;
+	if (!parse_args(argc, args, options)) {
+		print_usage(args[0]);
+		return 1;
+	}
+
+	// Cap the worker threads if asked to.
+	int threads = (options.threads > 0)? options.threads :
+		tbb::global_control::active_value(
+			tbb::global_control::max_allowed_parallelism);
+	tbb::global_control thread_limit(
+		tbb::global_control::max_allowed_parallelism, threads);
+
+	// Same world as the windowed build, boids wrap
+	// a perception radius off the edges.
+	const SimConfig& config = options.config;
+	Flightspace my_flock;
+	ObstacleGroup my_obs_group;
+	apply_config(config, &my_flock);
+	my_flock.set_obstacles(&my_obs_group);
+	my_flock.set_reorder_interval(options.reorder);
+	my_flock.set_tile_size(options.tile_size);
+	my_flock.set_neighbor_skin(options.skin);
+	my_flock.set_search_mode(options.search);
+	if (!options.load.empty()) {
+		// The snapshot brings its own bounds, weights and obstacles.
+		if (!load_snapshot(options.load, &my_flock, &my_obs_group)) {
+			return 1;
+		}
+	}
+	else {
+		populate(config, &my_flock, options.seed);
+	}
+	if (!options.obstacles.empty() &&
+		!load_obstacles(options.obstacles, &my_obs_group))
+	{
+		return 1;
+	}
+	FieldGroup my_fields;
+	DriftingFields drifting;
+	my_flock.set_fields(&my_fields);
+	drifting.spawn(options.fields, config, options.seed, &my_fields);
+
+	std::cout << "boids=" << my_flock.get_size() << " frames=" << options.frames
+		<< " world=" << config.get_world_w() << "x" << config.get_world_h()
+		<< " threads=" << threads
+		<< " obstacles=" << my_obs_group.get_size()
+		<< " fields=" << my_fields.get_size()
+		<< " kernel=" << kernel_name(my_flock.get_kernel_type()) << "\n";
+
+	if (options.verify > 0) {
+		return verify_search(my_flock, &my_obs_group, &my_fields, drifting,
+			options.verify, options.quiet)? 0 : 1;
+	}
+
+	TrajectoryRecorder recorder;
+	if (!options.record.empty() &&
+		!recorder.start(options.record, my_flock.get_bounds()))
+	{
+		return 1;
+	}
+
+	Profiler::get().set_enabled(!options.trace.empty());
+
+	// Positions of the frames check_record() compares against, in id order.
+	std::vector<std::vector<float>> check_x(options.check_count);
+	std::vector<std::vector<float>> check_y(options.check_count);
+
+	// The first frames size the scratch memory, after
+	// those a frame shouldn't allocate at all.
+	const int warmup = std::min(options.frames, 4);
+	uint64_t warm_allocations = 0;
+	double total_ms = 0.0, min_ms = 0.0, max_ms = 0.0;
+	for (int frame = 0; frame < options.frames; frame++) {
+		if (frame == warmup) {
+			warm_allocations = allocation_count();
+		}
+		auto start = std::chrono::steady_clock::now();
+
+		// Same step as the render loop, minus the rendering.
+		drifting.move(frame, &my_fields);
+		{
+			ProfileScope scope("update");
+			my_flock.update();
+		}
+
+		auto end = std::chrono::steady_clock::now();
+		// Only copies the positions, the writer thread does the rest.
+		recorder.record(my_flock);
+		int check = frame - options.check_first;
+		if (check >= 0 && check < options.check_count) {
+			const FlockData* p_data = my_flock.get_flock_data();
+			p_data->to_id_order(p_data->x, check_x[check]);
+			p_data->to_id_order(p_data->y, check_y[check]);
+		}
+		double ms = std::chrono::duration<double, std::milli>(end - start).count();
+		total_ms += ms;
+		min_ms = (frame == 0 || ms < min_ms)? ms : min_ms;
+		max_ms = (frame == 0 || ms > max_ms)? ms : max_ms;
+		if (!options.quiet) {
+			std::cout << "frame " << frame << ": " << ms << " ms\n";
+		}
+		Profiler::get().end_frame();
+	}
+
+	if (options.frames > 0) {
+		std::cout << "mean " << total_ms / options.frames << " ms, min "
+			<< min_ms << " ms, max " << max_ms << " ms\n";
+	}
+	if (options.frames > warmup) {
+		std::cout << "operator new calls after frame " << warmup << ": "
+			<< allocation_count() - warm_allocations << "\n";
+	}
+	if (options.skin > 0.0f) {
+		std::cout << "neighbor lists rebuilt " << my_flock.get_list_rebuilds()
+			<< " times in " << options.frames << " frames\n";
+	}
+	if (!options.trace.empty()) {
+		for (const std::string& line : Profiler::get().summary()) {
+			std::cout << line << "\n";
+		}
+		print_tile_summary(my_flock);
+		if (!Profiler::get().write_chrome_trace(options.trace)) {
+			std::cout << "Unable to write trace " << options.trace << "\n";
+			return 1;
+		}
+	}
+	if (recorder.is_recording()) {
+		recorder.stop();
+		std::cout << "recorded " << recorder.get_recorded() << " frames, dropped "
+			<< recorder.get_dropped() << "\n";
+		if (options.check_count > 0 &&
+			!check_record(options.record, options.check_first, check_x, check_y))
+		{
+			return 1;
+		}
+	}
+	if (!options.save.empty() &&
+		!save_snapshot(options.save, my_flock, &my_obs_group))
+	{
+		return 1;
+	}
+	if (!options.save_obstacles.empty() &&
+		!save_obstacles_binary(options.save_obstacles, my_obs_group))
+	{
+		return 1;
+	}
+	return 0;
+}
+
+void DriftingFields::spawn(int count, const SimConfig& config, uint64_t seed,
+	FieldGroup* p_fields)
+{
+	if (seed == 0) { seed = random_seed(); }
+	anchor_x.resize(count);
+	anchor_y.resize(count);
+	phase.resize(count);
+	fill_uniform(anchor_x.data(), count, 0.0f, config.get_world_w(), seed, 10);
+	fill_uniform(anchor_y.data(), count, 0.0f, config.get_world_h(), seed, 11);
+	fill_uniform(phase.data(), count, 0.0f, 6.2832f, seed, 12);
+	xs = anchor_x;
+	ys = anchor_y;
+	// Every other one pushes the flock away.
+	for (int i = 0; i < count; i++) {
+		float strength = (i % 2 == 0)? 2.0f : -3.0f;
+		p_fields->add_point(anchor_x[i], anchor_y[i], 120.0f, strength);
+	}
+}
+
+void DriftingFields::move(int frame, FieldGroup* p_fields) {
+	if (xs.empty()) {
+		return;
+	}
+	for (int i = 0; i < (int)xs.size(); i++) {
+		xs[i] = anchor_x[i] + 80.0f * std::cos(frame * 0.02f + phase[i]);
+		ys[i] = anchor_y[i] + 80.0f * std::sin(frame * 0.02f + phase[i]);
+	}
+	p_fields->set_positions(xs.data(), ys.data());
+}
+
+// Decodes stored frames [first, first + xs.size()) of the trajectory
+// at path and compares each to the positions it was recorded from,
+// which it has to match within half a quantum. A frame is recorded
+// at the step of its frame, so the range only lines up with the
+// kept positions if no frame before its end was dropped.
+bool check_record(const std::string& path, int first,
+	const std::vector<std::vector<float>>& xs, const std::vector<std::vector<float>>& ys)
+{
+	TrajectoryReader reader;
+	std::vector<TrajectoryFrame> frames;
+	int count = xs.size();
+	if (!reader.open(path) || !reader.read_frames(first, count, frames)) {
+		std::cout << "Unable to read frames " << first << " to " << first + count
+			<< " back from " << path << "\n";
+		return false;
+	}
+	WorldBounds bounds = reader.get_bounds();
+	// A little over half a quantum, for the float error of decoding.
+	float tolerance_x = 0.6f * (bounds.xmax - bounds.xmin) / 65535.0f;
+	float tolerance_y = 0.6f * (bounds.ymax - bounds.ymin) / 65535.0f;
+	float max_x = 0.0f, max_y = 0.0f;
+	for (int k = 0; k < count; k++) {
+		const TrajectoryFrame& frame = frames[k];
+		if (frame.step != (uint32_t)(first + k) || frame.x.size() != xs[k].size()) {
+			std::cout << "Trajectory frame " << first + k << " is step " << frame.step
+				<< " with " << frame.x.size() << " boids, expected step " << first + k
+				<< " with " << xs[k].size() << "\n";
+			return false;
+		}
+		for (int i = 0; i < (int)frame.x.size(); i++) {
+			max_x = std::max(max_x, std::abs(frame.x[i] - xs[k][i]));
+			max_y = std::max(max_y, std::abs(frame.y[i] - ys[k][i]));
+		}
+	}
+	bool matched = (max_x <= tolerance_x && max_y <= tolerance_y);
+	std::cout << "read back frames " << first << " to " << first + count
+		<< ", max error " << max_x << " x " << max_y << " against a quantum of "
+		<< tolerance_x / 0.6f << " x " << tolerance_y / 0.6f
+		<< (matched? "" : ", too far off") << "\n";
+	return matched;
+}
+
+// Steps flock next to a brute force copy of it and compares them.
+// The copy restarts from the flock's frame every step, so the two only
+// differ by that step, summing in another order doesn't compound.
+// Both find their neighbors with the same distance test, so any
+// boid that found a different number of them is a search bug.
+bool verify_search(Flightspace& flock, ObstacleGroup* p_obstacles, FieldGroup* p_fields,
+	DriftingFields& drifting, int frames, bool quiet)
+{
+	Flightspace reference;
+	WorldBounds bounds = flock.get_bounds();
+	reference.set_perception(flock.get_perception(), flock.get_cellsize());
+	reference.set_bounds(bounds.xmin, bounds.ymin, bounds.xmax, bounds.ymax);
+	reference.set_species(flock.get_species());
+	reference.set_obstacles(p_obstacles);
+	reference.set_fields(p_fields);
+	reference.set_search_mode(Flightspace::search_modes::BRUTE_FORCE);
+	reference.set_reorder_interval(0);
+	float width = bounds.xmax - bounds.xmin, height = bounds.ymax - bounds.ymin;
+
+	long mismatches = 0;
+	float max_diff = 0.0f;
+	for (int frame = 0; frame < frames; frame++) {
+		drifting.move(frame, p_fields);
+		*reference.get_flock_data() = *flock.get_flock_data();
+		reference.reset_neighbor_lists();
+		flock.update();
+		reference.update();
+
+		const FlockData* p_data = flock.get_flock_data();
+		const FlockData* p_ref = reference.get_flock_data();
+		int frame_mismatches = 0;
+		float frame_diff = 0.0f;
+		for (int id = 0; id < p_data->size(); id++) {
+			int s = p_data->slot[id], r = p_ref->slot[id];
+			frame_mismatches += (p_data->neighbors[s] != p_ref->neighbors[r]);
+			// A boid right at the edge may wrap in one and not the other.
+			float ox = std::abs(p_data->x[s] - p_ref->x[r]);
+			float oy = std::abs(p_data->y[s] - p_ref->y[r]);
+			frame_diff = std::max(frame_diff, std::min(ox, width - ox));
+			frame_diff = std::max(frame_diff, std::min(oy, height - oy));
+		}
+		mismatches += frame_mismatches;
+		max_diff = std::max(max_diff, frame_diff);
+		if (!quiet) {
+			std::cout << "frame " << frame << ": " << frame_mismatches
+				<< " neighbor count mismatches, max position difference "
+				<< frame_diff << "\n";
+		}
+	}
+	bool brute = (flock.get_search_mode() == Flightspace::search_modes::BRUTE_FORCE);
+	std::cout << "verify " << (brute? "brute" : "grid")
+		<< ((!brute && flock.get_neighbor_skin() > 0.0f)? " with lists" : "")
+		<< " against brute force over " << frames << " frames: "
+		<< mismatches << " neighbor count mismatches, max position difference "
+		<< max_diff << "\n";
+	// Every other frame reused the lists, wrapped boids and all.
+	if (!brute && flock.get_neighbor_skin() > 0.0f) {
+		std::cout << "neighbor lists rebuilt " << flock.get_list_rebuilds()
+			<< " times in " << frames << " frames\n";
+	}
+	return mismatches == 0;
+}
+
+// How evenly the last update's tiles were spread over the workers.
+// With good balancing the busiest worker is close to the mean.
+void print_tile_summary(const Flightspace& flock) {
+	std::vector<double> busy;
+	int tiles = 0;
+	float largest = 0.0f;
+	for (const TileStats& tile : flock.get_tile_stats()) {
+		if (tile.thread < 0) {
+			continue;
+		}
+		if (tile.thread >= (int)busy.size()) {
+			busy.resize(tile.thread + 1, 0.0);
+		}
+		busy[tile.thread] += tile.ms;
+		largest = std::max(largest, tile.ms);
+		tiles++;
+	}
+	double total = 0.0, busiest = 0.0;
+	int workers = 0;
+	for (double ms : busy) {
+		total += ms;
+		busiest = std::max(busiest, ms);
+		workers += (ms > 0.0);
+	}
+	std::cout << "tiles=" << tiles << " workers=" << workers
+		<< " busiest " << busiest << " ms, mean "
+		<< ((workers > 0)? total / workers : 0.0) << " ms, largest tile "
+		<< largest << " ms\n";
+}
+
+void print_usage(const char* exec) {
+	std::cout << "Usage: " << exec << " [options]\n"
+		<< "  --config F    Config file, the options below override it\n"
+		<< "  --boids N     Number of boids (2250)\n"
+		<< "  --predators N Number of predators hunting them (0)\n"
+		<< "  --frames N    Frames to simulate (600)\n"
+		<< "  --width N     World width (1280)\n"
+		<< "  --height N    World height (720)\n"
+		<< "  --speed N     Boid speed in pixels per frame (3.25)\n"
+		<< "  --perception N  Perception radius (20)\n"
+		<< "  --cellsize N  Grid cell size, 0 for the perception radius (0)\n"
+		<< "  --fields N    Moving attractors and repulsors (0)\n"
+		<< "  --reorder N   Frames between storing the boids in Morton order, 0 never (32)\n"
+		<< "  --tile-size N Cells per side of the tiles the rules run in, 0 for auto (0)\n"
+		<< "  --lists N     Reuse neighbor lists with this skin past the perception, 0 off (0)\n"
+		<< "  --search S    Neighbor search, grid or brute (grid)\n"
+		<< "  --verify N    Step N frames next to brute force and compare, instead of timing\n"
+		<< "  --threads N   Worker threads, 0 for all cores (0)\n"
+		<< "  --seed N      Flock seed, 0 for a random flock (0)\n"
+		<< "  --obstacles F Obstacle file, binary or .csv (none)\n"
+		<< "  --save-obstacles F  Write the obstacles as a binary file after the last frame\n"
+		<< "  --load F      Start from a snapshot instead of a random flock\n"
+		<< "  --save F      Write a snapshot after the last frame\n"
+		<< "  --record F    Record every frame's positions to a trajectory file\n"
+		<< "  --check-record F FIRST COUNT  Record to F, then read frames\n"
+		<< "                [FIRST, FIRST + COUNT) back and compare them\n"
+		<< "  --trace F     Profile, print phase times and write a Chrome trace\n"
+		<< "  --quiet       Only print the summary\n"
+		<< "  --help        Show this message\n";
+}
+
+bool parse_args(int argc, char* args[], HeadlessOptions& options) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = args[i];
+		if (arg == "--quiet") {
+			options.quiet = true;
+			continue;
+		}
+		if (arg == "--help") {
+			return false;
+		}
+		// Everything else takes a value.
+		if (i + 1 >= argc) {
+			std::cout << "Missing value for " << arg << "\n";
+			return false;
+		}
+		if (arg == "--check-record") {
+			long first = 0, count = 0;
+			if (i + 3 >= argc || !parse_whole(args[i + 2], INT_MAX, &first) ||
+				!parse_whole(args[i + 3], INT_MAX - first, &count))
+			{
+				std::cout << "--check-record takes a file, a first frame and a count\n";
+				return false;
+			}
+			options.record = args[i + 1];
+			options.check_first = first;
+			options.check_count = count;
+			i += 3;
+			continue;
+		}
+		if (arg == "--config") {
+			if (!load_config(args[++i], &options.config)) {
+				return false;
+			}
+			continue;
+		}
+		if (arg == "--search") {
+			std::string mode = args[++i];
+			if (mode != "grid" && mode != "brute") {
+				std::cout << "Bad value for " << arg << ": " << mode << "\n";
+				return false;
+			}
+			options.search = (mode == "brute")? Flightspace::search_modes::BRUTE_FORCE :
+				Flightspace::search_modes::GRID;
+			continue;
+		}
+		if (arg == "--obstacles" || arg == "--save-obstacles" || arg == "--load" ||
+			arg == "--save" || arg == "--record" || arg == "--trace")
+		{
+			std::string& path = (arg == "--obstacles")? options.obstacles :
+				(arg == "--save-obstacles")? options.save_obstacles :
+				(arg == "--load")? options.load :
+				(arg == "--save")? options.save :
+				(arg == "--record")? options.record : options.trace;
+			path = args[++i];
+			continue;
+		}
+		bool is_real = (arg == "--perception" || arg == "--cellsize" ||
+			arg == "--speed" || arg == "--lists");
+		long whole = 0;
+		double real = 0.0;
+		// The seed is the only option past an int.
+		long max = (arg == "--seed")? LONG_MAX : INT_MAX;
+		bool parsed = is_real? parse_real(args[++i], &real) : parse_whole(args[++i], max, &whole);
+		if (!parsed || ((arg == "--perception" || arg == "--speed") && real == 0.0)) {
+			std::cout << "Bad value for " << arg << ": " << args[i] << "\n";
+			return false;
+		}
+		if (arg == "--boids") { options.config.boids = whole; }
+		else if (arg == "--predators") { options.config.predators = whole; }
+		else if (arg == "--frames") { options.frames = whole; }
+		else if (arg == "--width") { options.config.world_w = whole; }
+		else if (arg == "--height") { options.config.world_h = whole; }
+		else if (arg == "--speed") { options.config.speed = real; }
+		else if (arg == "--perception") { options.config.perception = real; }
+		else if (arg == "--cellsize") { options.config.cellsize = real; }
+		else if (arg == "--threads") { options.threads = whole; }
+		else if (arg == "--seed") { options.seed = whole; }
+		else if (arg == "--fields") { options.fields = whole; }
+		else if (arg == "--reorder") { options.reorder = whole; }
+		else if (arg == "--tile-size") { options.tile_size = whole; }
+		else if (arg == "--lists") { options.skin = real; }
+		else if (arg == "--verify") { options.verify = whole; }
+		else {
+			std::cout << "Unknown option " << arg << "\n";
+			return false;
+		}
+	}
+	// The options may have grown the world past what the config checked.
+	return check_config(options.config, "options");
+}
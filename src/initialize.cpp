@@ -4,11 +4,9 @@
 #include "initialize.hpp"
 
 // Screen parameters.
-constexpr int SCR_W = 1280;
-constexpr int SCR_H = 720;
 constexpr int SFX_VOLUME = 64;
-constexpr int NUM_BOIDS = 2250;
 const std::string ASSET_DIR = "res/";
+SimConfig g_config;
 
 // Global pointers to sdl objects.
 SDL_Window* g_window = NULL;
@@ -19,11 +17,16 @@ SDL_Renderer* g_renderer = NULL;
 TextureWrap* g_tex_boid = new TextureWrap();
 TextureWrap* g_tex_vignette = new TextureWrap();
 TextureWrap* g_tex_obstacle = new TextureWrap();
+SpriteBatch* g_boid_batch = new SpriteBatch(g_tex_boid, 2);
+SpriteBatch* g_obstacle_batch = new SpriteBatch(g_tex_obstacle);
+RectBatch* g_density_batch = new RectBatch();
+RectBatch* g_field_batch = new RectBatch();
 Slider* g_slider_separation;
 Slider* g_slider_alignment;
 Slider* g_slider_cohesion;
 TextBox* g_titlebox = new TextBox();
 TextBox* g_textbox = new TextBox();
+TextBox* g_hud_box = new TextBox();
 
 // Sound objects.
 Playlist* g_playlist = new Playlist();
@@ -75,7 +78,7 @@ void _init_window(bool& success)
 		// Create an sdl window.
 		g_window = SDL_CreateWindow("Chillin With the Boids",
 			SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-			SCR_W, SCR_H, SDL_WINDOW_SHOWN);
+			g_config.screen_w, g_config.screen_h, SDL_WINDOW_SHOWN);
 		if (g_window == NULL) {
 			error_msg("Window creation failed!", error_types::REGULAR_ERROR);
 			// Set success to false.
@@ -151,6 +154,7 @@ bool _asset_load() {
 	// Initialize objects.
 	g_titlebox->configure(ASSET_DIR + "aquire.ttf", 32);
 	g_textbox->configure(ASSET_DIR + "aquire.ttf", 20);
+	g_hud_box->configure(ASSET_DIR + "aquire.ttf", 14);
 
 	// Set SFX volume.
 	SFX::global_volume(SFX_VOLUME);
@@ -165,6 +169,7 @@ bool _asset_load() {
 
     // Shit code section, no failsafes because I added this in quick
     SDL_Rect button_rect = SDL_Rect{10, 10, 16, 16};
+    const int SCR_W = g_config.screen_w, SCR_H = g_config.screen_h;
     g_slider_cohesion = new Slider(
         SDL_Rect{SCR_W - 330, SCR_H - 30, 300, 10}, button_rect,
         0.0, 3.5f, new TextBox(ASSET_DIR + "aquire.ttf", 20));
@@ -183,18 +188,24 @@ bool _asset_load() {
 	_load_tex(load_passed, g_tex_obstacle, ASSET_DIR + "obstacle.png");
 	_load_textbox(load_passed, g_titlebox, "A Boids Simulation");
 	_load_textbox(load_passed, g_textbox,
-		"M = Mute, N = Unmute, R = Remove Obstacles");
+		"M = Mute, N = Unmute, R = Remove Obstacles, S = Save, L = Load,"
+		" P = Profiler, T = Trace, Arrows/Wheel = Camera, Home = Reset");
 	return load_passed;
 }
 
 void _asset_destroy() {
 	// Deallocate all objects memory.
 	// Kinda a wall of text.
+	delete g_boid_batch; g_boid_batch = nullptr;
+	delete g_obstacle_batch; g_obstacle_batch = nullptr;
+	delete g_density_batch; g_density_batch = nullptr;
+	delete g_field_batch; g_field_batch = nullptr;
 	delete g_tex_boid; g_tex_boid = nullptr;
 	delete g_tex_vignette; g_tex_vignette = nullptr;
 	delete g_tex_obstacle; g_tex_obstacle = nullptr;
 	delete g_titlebox; g_titlebox = nullptr;
 	delete g_textbox; g_textbox = nullptr;
+	delete g_hud_box; g_hud_box = nullptr;
 	delete g_click_sfx; g_click_sfx = nullptr;
 	delete g_playlist; g_playlist = nullptr;
     delete g_slider_cohesion; g_slider_cohesion = nullptr;
@@ -9,13 +9,13 @@
 // SDL wrapper objects.
 #include "wrappers.hpp"
 #include "tinyerror.hpp"
+#include "config.hpp"
 
 // Extern variables.
-extern const int SCR_W;
-extern const int SCR_H;
 extern const int SFX_VOLUME;
-extern const int NUM_BOIDS;
 extern const std::string ASSET_DIR;
+// Screen size, flock size and perception, load it before try_init().
+extern SimConfig g_config;
 
 // Window and renderer.
 extern SDL_Window* g_window;
@@ -26,11 +26,16 @@ extern SDL_Renderer* g_renderer;
 extern TextureWrap* g_tex_boid;
 extern TextureWrap* g_tex_vignette;
 extern TextureWrap* g_tex_obstacle;
+extern SpriteBatch* g_boid_batch;
+extern SpriteBatch* g_obstacle_batch;
+extern RectBatch* g_density_batch;
+extern RectBatch* g_field_batch;
 extern Slider* g_slider_separation;
 extern Slider* g_slider_alignment;
 extern Slider* g_slider_cohesion;
 extern TextBox* g_titlebox;
 extern TextBox* g_textbox;
+extern TextBox* g_hud_box;
 
 // Sound objects.
 extern Playlist* g_playlist;
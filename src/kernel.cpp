@@ -0,0 +1,580 @@
+// Kernel.cpp
+// Flocking kernels and runtime kernel selection.
+
+#include "kernel.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNEL_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define KERNEL_NEON
+#include <arm_neon.h>
+#endif
+
+// Member function definitions for NeighborData
+void NeighborData::resize(int size) {
+	// Padding is zeroed and never counted, it only keeps loads in bounds.
+	x.resize(size + KERNEL_WIDTH, 0.0f);
+	y.resize(size + KERNEL_WIDTH, 0.0f);
+	dx.resize(size + KERNEL_WIDTH, 0.0f);
+	dy.resize(size + KERNEL_WIDTH, 0.0f);
+	index.resize(size + KERNEL_WIDTH, -1);
+	species.resize(size + KERNEL_WIDTH, 0);
+}
+
+int NeighborData::size() const {
+	return (int)x.size() - KERNEL_WIDTH;
+}
+
+// Adds the candidate in slot k if it's in range and isn't self.
+template <bool SPECIES>
+static inline void scalar_step(const NeighborData& data, int k, int id,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums)
+{
+	float ox = px - data.x[k];
+	float oy = py - data.y[k];
+	float d2 = ox*ox + oy*oy;
+	if (d2 < radius * radius && id != self) {
+		float weight = (radius - std::sqrt(d2)) / radius;
+		float w_sep = 1.0f, w_align = 1.0f, w_coh = 1.0f;
+		if (SPECIES) {
+			int species = data.species[k];
+			w_sep = p_row->separate[species];
+			w_align = p_row->align[species];
+			w_coh = p_row->cohede[species];
+		}
+		sums.sep_x += ox * weight * w_sep;
+		sums.sep_y += oy * weight * w_sep;
+		sums.align_x += data.dx[k] * w_align;
+		sums.align_y += data.dy[k] * w_align;
+		sums.coh_x += data.x[k] * w_coh;
+		sums.coh_y += data.y[k] * w_coh;
+		sums.coh_weight += w_coh;
+		++sums.count;
+	}
+}
+
+// Scalar kernel, also the reference for the wide ones.
+template <bool SPECIES>
+static void scalar_impl(const NeighborData& data, int begin, int end,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums)
+{
+	for (int k = begin; k < end; k++) {
+		scalar_step<SPECIES>(data, k, data.index[k], px, py, self, radius, p_row, sums);
+	}
+}
+
+// Same, reading each candidate from the slot it names.
+template <bool SPECIES>
+static void scalar_slots_impl(const NeighborData& data, const int* slots, int count,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums)
+{
+	for (int j = 0; j < count; j++) {
+		scalar_step<SPECIES>(data, slots[j], slots[j], px, py, self, radius, p_row, sums);
+	}
+}
+
+static void kernel_scalar(const NeighborData& data, int begin, int end,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums)
+{
+	if (p_row != nullptr) {
+		scalar_impl<true>(data, begin, end, px, py, self, radius, p_row, sums);
+	}
+	else {
+		scalar_impl<false>(data, begin, end, px, py, self, radius, p_row, sums);
+	}
+}
+
+static void slot_kernel_scalar(const NeighborData& data, const int* slots, int count,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums)
+{
+	if (p_row != nullptr) {
+		scalar_slots_impl<true>(data, slots, count, px, py, self, radius, p_row, sums);
+	}
+	else {
+		scalar_slots_impl<false>(data, slots, count, px, py, self, radius, p_row, sums);
+	}
+}
+
+#ifdef KERNEL_X86
+// Horizontal sums.
+static inline float hsum_128(__m128 v) {
+	__m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+__attribute__((target("avx2")))
+static inline float hsum_256(__m256 v) {
+	return hsum_128(_mm_add_ps(_mm256_castps256_ps128(v),
+		_mm256_extractf128_ps(v, 1)));
+}
+
+// Accumulators and constants for the AVX2 kernels.
+struct AVX2Sums {
+	__m256 sep_x, sep_y, align_x, align_y, coh_x, coh_y, coh_w, count;
+};
+
+struct AVX2Consts {
+	__m256 px, py, r, r2;
+	__m256i self;
+	__m256 row_sep, row_align, row_coh;
+};
+
+__attribute__((target("avx2")))
+static inline AVX2Consts avx2_consts(float px, float py, int self, float radius,
+	const InteractionRow* p_row)
+{
+	const __m256 v_one = _mm256_set1_ps(1.0f);
+	AVX2Consts c = {_mm256_set1_ps(px), _mm256_set1_ps(py), _mm256_set1_ps(radius),
+		_mm256_set1_ps(radius * radius), _mm256_set1_epi32(self), v_one, v_one, v_one};
+	if (p_row != nullptr) {
+		c.row_sep = _mm256_loadu_ps(p_row->separate);
+		c.row_align = _mm256_loadu_ps(p_row->align);
+		c.row_coh = _mm256_loadu_ps(p_row->cohede);
+	}
+	return c;
+}
+
+// 8 loaded candidates, valid marks the lanes holding one.
+// A species row is 8 floats, so picking each lane's weight
+// is a single permute by the neighbor species ids.
+template <bool SPECIES>
+__attribute__((target("avx2")))
+static inline void avx2_step(__m256 qx, __m256 qy, __m256 dx, __m256 dy,
+	__m256i species, __m256i ids, __m256i valid, const AVX2Consts& c, AVX2Sums& acc)
+{
+	const __m256 v_one = _mm256_set1_ps(1.0f);
+	__m256 ox = _mm256_sub_ps(c.px, qx);
+	__m256 oy = _mm256_sub_ps(c.py, qy);
+	__m256 d2 = _mm256_add_ps(_mm256_mul_ps(ox, ox), _mm256_mul_ps(oy, oy));
+
+	// In range, inside the radius, and not ourselves.
+	__m256 mask = _mm256_and_ps(_mm256_cmp_ps(d2, c.r2, _CMP_LT_OQ),
+		_mm256_castsi256_ps(valid));
+	mask = _mm256_andnot_ps(
+		_mm256_castsi256_ps(_mm256_cmpeq_epi32(ids, c.self)), mask);
+
+	__m256 weight = _mm256_div_ps(
+		_mm256_sub_ps(c.r, _mm256_sqrt_ps(d2)), c.r);
+	if (SPECIES) {
+		__m256 w_coh = _mm256_permutevar8x32_ps(c.row_coh, species);
+		weight = _mm256_mul_ps(weight, _mm256_permutevar8x32_ps(c.row_sep, species));
+		__m256 w_align = _mm256_permutevar8x32_ps(c.row_align, species);
+		dx = _mm256_mul_ps(dx, w_align);
+		dy = _mm256_mul_ps(dy, w_align);
+		acc.coh_x = _mm256_add_ps(acc.coh_x, _mm256_and_ps(mask, _mm256_mul_ps(qx, w_coh)));
+		acc.coh_y = _mm256_add_ps(acc.coh_y, _mm256_and_ps(mask, _mm256_mul_ps(qy, w_coh)));
+		acc.coh_w = _mm256_add_ps(acc.coh_w, _mm256_and_ps(mask, w_coh));
+	}
+	else {
+		acc.coh_x = _mm256_add_ps(acc.coh_x, _mm256_and_ps(mask, qx));
+		acc.coh_y = _mm256_add_ps(acc.coh_y, _mm256_and_ps(mask, qy));
+	}
+	acc.sep_x = _mm256_add_ps(acc.sep_x, _mm256_and_ps(mask, _mm256_mul_ps(ox, weight)));
+	acc.sep_y = _mm256_add_ps(acc.sep_y, _mm256_and_ps(mask, _mm256_mul_ps(oy, weight)));
+	acc.align_x = _mm256_add_ps(acc.align_x, _mm256_and_ps(mask, dx));
+	acc.align_y = _mm256_add_ps(acc.align_y, _mm256_and_ps(mask, dy));
+	acc.count = _mm256_add_ps(acc.count, _mm256_and_ps(mask, v_one));
+}
+
+template <bool SPECIES>
+__attribute__((target("avx2")))
+static inline void avx2_finish(const AVX2Sums& acc, FlockSums& sums) {
+	sums.sep_x += hsum_256(acc.sep_x);
+	sums.sep_y += hsum_256(acc.sep_y);
+	sums.align_x += hsum_256(acc.align_x);
+	sums.align_y += hsum_256(acc.align_y);
+	sums.coh_x += hsum_256(acc.coh_x);
+	sums.coh_y += hsum_256(acc.coh_y);
+	int found = (int)hsum_256(acc.count);
+	sums.coh_weight += SPECIES? hsum_256(acc.coh_w) : found;
+	sums.count += found;
+}
+
+// 8 candidates per iteration in one AVX2 register.
+template <bool SPECIES>
+__attribute__((target("avx2")))
+static void avx2_impl(const NeighborData& data, int begin, int end,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums)
+{
+	const AVX2Consts c = avx2_consts(px, py, self, radius, p_row);
+	const __m256i v_end = _mm256_set1_epi32(end);
+	const __m256i v_lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256 zero = _mm256_setzero_ps();
+	AVX2Sums acc = {zero, zero, zero, zero, zero, zero, zero, zero};
+
+	for (int k = begin; k < end; k += 8) {
+		__m256i slots = _mm256_add_epi32(_mm256_set1_epi32(k), v_lanes);
+		avx2_step<SPECIES>(_mm256_loadu_ps(&data.x[k]), _mm256_loadu_ps(&data.y[k]),
+			_mm256_loadu_ps(&data.dx[k]), _mm256_loadu_ps(&data.dy[k]),
+			SPECIES? _mm256_loadu_si256((const __m256i*)&data.species[k]) : _mm256_setzero_si256(),
+			_mm256_loadu_si256((const __m256i*)&data.index[k]),
+			_mm256_cmpgt_epi32(v_end, slots), c, acc);
+	}
+	avx2_finish<SPECIES>(acc, sums);
+}
+
+// Same, gathering each candidate from the slot it names.
+template <bool SPECIES>
+__attribute__((target("avx2")))
+static void avx2_slots_impl(const NeighborData& data, const int* slots, int count,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums)
+{
+	const AVX2Consts c = avx2_consts(px, py, self, radius, p_row);
+	const __m256i v_count = _mm256_set1_epi32(count);
+	const __m256i v_lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256 zero = _mm256_setzero_ps();
+	AVX2Sums acc = {zero, zero, zero, zero, zero, zero, zero, zero};
+
+	for (int j = 0; j < count; j += 8) {
+		// Lanes past the end neither load a slot nor gather from one.
+		__m256i valid = _mm256_cmpgt_epi32(v_count,
+			_mm256_add_epi32(_mm256_set1_epi32(j), v_lanes));
+		__m256 valid_ps = _mm256_castsi256_ps(valid);
+		__m256i ids = _mm256_maskload_epi32(slots + j, valid);
+		__m256i species = _mm256_setzero_si256();
+		if (SPECIES) {
+			species = _mm256_mask_i32gather_epi32(species, data.species.data(), ids, valid, 4);
+		}
+		avx2_step<SPECIES>(_mm256_mask_i32gather_ps(zero, data.x.data(), ids, valid_ps, 4),
+			_mm256_mask_i32gather_ps(zero, data.y.data(), ids, valid_ps, 4),
+			_mm256_mask_i32gather_ps(zero, data.dx.data(), ids, valid_ps, 4),
+			_mm256_mask_i32gather_ps(zero, data.dy.data(), ids, valid_ps, 4),
+			species, ids, valid, c, acc);
+	}
+	avx2_finish<SPECIES>(acc, sums);
+}
+
+__attribute__((target("avx2")))
+static void kernel_avx2(const NeighborData& data, int begin, int end,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums)
+{
+	if (p_row != nullptr) {
+		avx2_impl<true>(data, begin, end, px, py, self, radius, p_row, sums);
+	}
+	else {
+		avx2_impl<false>(data, begin, end, px, py, self, radius, p_row, sums);
+	}
+}
+
+__attribute__((target("avx2")))
+static void slot_kernel_avx2(const NeighborData& data, const int* slots, int count,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums)
+{
+	if (p_row != nullptr) {
+		avx2_slots_impl<true>(data, slots, count, px, py, self, radius, p_row, sums);
+	}
+	else {
+		avx2_slots_impl<false>(data, slots, count, px, py, self, radius, p_row, sums);
+	}
+}
+
+// SSE2 is always there on x86_64, so this doesn't need a target.
+// Accumulators for the SSE kernel.
+struct SSESums {
+	__m128 sep_x, sep_y, align_x, align_y, coh_x, coh_y, coh_w, count;
+};
+
+// 4 candidates starting at slot k.
+// SSE2 has no variable permute, species weights are looked up per lane.
+template <bool SPECIES>
+static inline void sse_step(const NeighborData& data, int k,
+	__m128 v_px, __m128 v_py, __m128 v_r, __m128 v_r2,
+	__m128i v_self, __m128i v_end, const InteractionRow* p_row, SSESums& acc)
+{
+	const __m128i v_lanes = _mm_setr_epi32(0, 1, 2, 3);
+	__m128 qx = _mm_loadu_ps(&data.x[k]);
+	__m128 qy = _mm_loadu_ps(&data.y[k]);
+	__m128 ox = _mm_sub_ps(v_px, qx);
+	__m128 oy = _mm_sub_ps(v_py, qy);
+	__m128 d2 = _mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy));
+
+	__m128i slots = _mm_add_epi32(_mm_set1_epi32(k), v_lanes);
+	__m128i ids = _mm_loadu_si128((const __m128i*)&data.index[k]);
+	__m128 mask = _mm_and_ps(_mm_cmplt_ps(d2, v_r2),
+		_mm_castsi128_ps(_mm_cmpgt_epi32(v_end, slots)));
+	mask = _mm_andnot_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(ids, v_self)), mask);
+
+	__m128 weight = _mm_div_ps(_mm_sub_ps(v_r, _mm_sqrt_ps(d2)), v_r);
+	__m128 dx = _mm_loadu_ps(&data.dx[k]);
+	__m128 dy = _mm_loadu_ps(&data.dy[k]);
+	if (SPECIES) {
+		const int* species = &data.species[k];
+		__m128 w_sep = _mm_setr_ps(p_row->separate[species[0]], p_row->separate[species[1]],
+			p_row->separate[species[2]], p_row->separate[species[3]]);
+		__m128 w_align = _mm_setr_ps(p_row->align[species[0]], p_row->align[species[1]],
+			p_row->align[species[2]], p_row->align[species[3]]);
+		__m128 w_coh = _mm_setr_ps(p_row->cohede[species[0]], p_row->cohede[species[1]],
+			p_row->cohede[species[2]], p_row->cohede[species[3]]);
+		weight = _mm_mul_ps(weight, w_sep);
+		dx = _mm_mul_ps(dx, w_align);
+		dy = _mm_mul_ps(dy, w_align);
+		qx = _mm_mul_ps(qx, w_coh);
+		qy = _mm_mul_ps(qy, w_coh);
+		acc.coh_w = _mm_add_ps(acc.coh_w, _mm_and_ps(mask, w_coh));
+	}
+	acc.sep_x = _mm_add_ps(acc.sep_x, _mm_and_ps(mask, _mm_mul_ps(ox, weight)));
+	acc.sep_y = _mm_add_ps(acc.sep_y, _mm_and_ps(mask, _mm_mul_ps(oy, weight)));
+	acc.align_x = _mm_add_ps(acc.align_x, _mm_and_ps(mask, dx));
+	acc.align_y = _mm_add_ps(acc.align_y, _mm_and_ps(mask, dy));
+	acc.coh_x = _mm_add_ps(acc.coh_x, _mm_and_ps(mask, qx));
+	acc.coh_y = _mm_add_ps(acc.coh_y, _mm_and_ps(mask, qy));
+	acc.count = _mm_add_ps(acc.count, _mm_and_ps(mask, _mm_set1_ps(1.0f)));
+}
+
+// 8 candidates per iteration as two SSE registers.
+template <bool SPECIES>
+static void sse_impl(const NeighborData& data, int begin, int end,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums)
+{
+	const __m128 v_px = _mm_set1_ps(px);
+	const __m128 v_py = _mm_set1_ps(py);
+	const __m128 v_r = _mm_set1_ps(radius);
+	const __m128 v_r2 = _mm_set1_ps(radius * radius);
+	const __m128i v_self = _mm_set1_epi32(self);
+	const __m128i v_end = _mm_set1_epi32(end);
+
+	__m128 zero = _mm_setzero_ps();
+	SSESums acc = {zero, zero, zero, zero, zero, zero, zero, zero};
+	for (int k = begin; k < end; k += 8) {
+		sse_step<SPECIES>(data, k, v_px, v_py, v_r, v_r2, v_self, v_end, p_row, acc);
+		sse_step<SPECIES>(data, k + 4, v_px, v_py, v_r, v_r2, v_self, v_end, p_row, acc);
+	}
+
+	sums.sep_x += hsum_128(acc.sep_x);
+	sums.sep_y += hsum_128(acc.sep_y);
+	sums.align_x += hsum_128(acc.align_x);
+	sums.align_y += hsum_128(acc.align_y);
+	sums.coh_x += hsum_128(acc.coh_x);
+	sums.coh_y += hsum_128(acc.coh_y);
+	int found = (int)hsum_128(acc.count);
+	sums.coh_weight += SPECIES? hsum_128(acc.coh_w) : found;
+	sums.count += found;
+}
+
+static void kernel_sse(const NeighborData& data, int begin, int end,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums)
+{
+	if (p_row != nullptr) {
+		sse_impl<true>(data, begin, end, px, py, self, radius, p_row, sums);
+	}
+	else {
+		sse_impl<false>(data, begin, end, px, py, self, radius, p_row, sums);
+	}
+}
+#endif
+
+#ifdef KERNEL_NEON
+// Accumulators for the NEON kernel.
+struct NEONSums {
+	float32x4_t sep_x, sep_y, align_x, align_y, coh_x, coh_y, coh_w, count;
+};
+
+// Masks a float vector with a comparison result.
+static inline float32x4_t neon_mask(uint32x4_t mask, float32x4_t v) {
+	return vreinterpretq_f32_u32(vandq_u32(mask, vreinterpretq_u32_f32(v)));
+}
+
+// Looks up one weight per lane from a species row.
+static inline float32x4_t neon_lookup(const float* row, const int* species) {
+	const float lanes[4] = {row[species[0]], row[species[1]],
+		row[species[2]], row[species[3]]};
+	return vld1q_f32(lanes);
+}
+
+// 4 candidates starting at slot k.
+template <bool SPECIES>
+static inline void neon_step(const NeighborData& data, int k,
+	float32x4_t v_px, float32x4_t v_py, float32x4_t v_r, float32x4_t v_r2,
+	int32x4_t v_self, int32x4_t v_end, const InteractionRow* p_row, NEONSums& acc)
+{
+	const int32_t lanes[4] = {0, 1, 2, 3};
+	float32x4_t qx = vld1q_f32(&data.x[k]);
+	float32x4_t qy = vld1q_f32(&data.y[k]);
+	float32x4_t ox = vsubq_f32(v_px, qx);
+	float32x4_t oy = vsubq_f32(v_py, qy);
+	float32x4_t d2 = vaddq_f32(vmulq_f32(ox, ox), vmulq_f32(oy, oy));
+
+	int32x4_t slots = vaddq_s32(vdupq_n_s32(k), vld1q_s32(lanes));
+	int32x4_t ids = vld1q_s32(&data.index[k]);
+	uint32x4_t mask = vandq_u32(vcltq_f32(d2, v_r2), vcltq_s32(slots, v_end));
+	mask = vbicq_u32(mask, vceqq_s32(ids, v_self));
+
+	float32x4_t weight = vdivq_f32(vsubq_f32(v_r, vsqrtq_f32(d2)), v_r);
+	float32x4_t dx = vld1q_f32(&data.dx[k]);
+	float32x4_t dy = vld1q_f32(&data.dy[k]);
+	if (SPECIES) {
+		const int* species = &data.species[k];
+		float32x4_t w_align = neon_lookup(p_row->align, species);
+		float32x4_t w_coh = neon_lookup(p_row->cohede, species);
+		weight = vmulq_f32(weight, neon_lookup(p_row->separate, species));
+		dx = vmulq_f32(dx, w_align);
+		dy = vmulq_f32(dy, w_align);
+		qx = vmulq_f32(qx, w_coh);
+		qy = vmulq_f32(qy, w_coh);
+		acc.coh_w = vaddq_f32(acc.coh_w, neon_mask(mask, w_coh));
+	}
+	acc.sep_x = vaddq_f32(acc.sep_x, neon_mask(mask, vmulq_f32(ox, weight)));
+	acc.sep_y = vaddq_f32(acc.sep_y, neon_mask(mask, vmulq_f32(oy, weight)));
+	acc.align_x = vaddq_f32(acc.align_x, neon_mask(mask, dx));
+	acc.align_y = vaddq_f32(acc.align_y, neon_mask(mask, dy));
+	acc.coh_x = vaddq_f32(acc.coh_x, neon_mask(mask, qx));
+	acc.coh_y = vaddq_f32(acc.coh_y, neon_mask(mask, qy));
+	acc.count = vaddq_f32(acc.count, neon_mask(mask, vdupq_n_f32(1.0f)));
+}
+
+// 8 candidates per iteration as two NEON registers.
+template <bool SPECIES>
+static void neon_impl(const NeighborData& data, int begin, int end,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums)
+{
+	const float32x4_t v_px = vdupq_n_f32(px);
+	const float32x4_t v_py = vdupq_n_f32(py);
+	const float32x4_t v_r = vdupq_n_f32(radius);
+	const float32x4_t v_r2 = vdupq_n_f32(radius * radius);
+	const int32x4_t v_self = vdupq_n_s32(self);
+	const int32x4_t v_end = vdupq_n_s32(end);
+
+	float32x4_t zero = vdupq_n_f32(0.0f);
+	NEONSums acc = {zero, zero, zero, zero, zero, zero, zero, zero};
+	for (int k = begin; k < end; k += 8) {
+		neon_step<SPECIES>(data, k, v_px, v_py, v_r, v_r2, v_self, v_end, p_row, acc);
+		neon_step<SPECIES>(data, k + 4, v_px, v_py, v_r, v_r2, v_self, v_end, p_row, acc);
+	}
+
+	sums.sep_x += vaddvq_f32(acc.sep_x);
+	sums.sep_y += vaddvq_f32(acc.sep_y);
+	sums.align_x += vaddvq_f32(acc.align_x);
+	sums.align_y += vaddvq_f32(acc.align_y);
+	sums.coh_x += vaddvq_f32(acc.coh_x);
+	sums.coh_y += vaddvq_f32(acc.coh_y);
+	int found = (int)vaddvq_f32(acc.count);
+	sums.coh_weight += SPECIES? vaddvq_f32(acc.coh_w) : found;
+	sums.count += found;
+}
+
+static void kernel_neon(const NeighborData& data, int begin, int end,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums)
+{
+	if (p_row != nullptr) {
+		neon_impl<true>(data, begin, end, px, py, self, radius, p_row, sums);
+	}
+	else {
+		neon_impl<false>(data, begin, end, px, py, self, radius, p_row, sums);
+	}
+}
+#endif
+
+bool kernel_supported(kernel_types type) {
+	switch (type) {
+		case kernel_types::SCALAR:
+			return true;
+#ifdef KERNEL_X86
+		case kernel_types::SSE:
+			return true;
+		case kernel_types::AVX2:
+			return __builtin_cpu_supports("avx2");
+#endif
+#ifdef KERNEL_NEON
+		case kernel_types::NEON:
+			return true;
+#endif
+		default:
+			return false;
+	}
+}
+
+kernel_types best_kernel_type() {
+	// Widest first.
+	if (kernel_supported(kernel_types::AVX2)) { return kernel_types::AVX2; }
+	if (kernel_supported(kernel_types::NEON)) { return kernel_types::NEON; }
+	if (kernel_supported(kernel_types::SSE)) { return kernel_types::SSE; }
+	return kernel_types::SCALAR;
+}
+
+flock_kernel get_kernel(kernel_types type) {
+	// Unsupported kernels fall back to scalar.
+	if (!kernel_supported(type)) {
+		return kernel_scalar;
+	}
+	switch (type) {
+#ifdef KERNEL_X86
+		case kernel_types::SSE: return kernel_sse;
+		case kernel_types::AVX2: return kernel_avx2;
+#endif
+#ifdef KERNEL_NEON
+		case kernel_types::NEON: return kernel_neon;
+#endif
+		default: return kernel_scalar;
+	}
+}
+
+slot_kernel get_slot_kernel(kernel_types type) {
+	// Only AVX2 gathers, the others read one slot at a time.
+#ifdef KERNEL_X86
+	if (type == kernel_types::AVX2 && kernel_supported(type)) {
+		return slot_kernel_avx2;
+	}
+#endif
+	(void)type;
+	return slot_kernel_scalar;
+}
+
+const char* kernel_name(kernel_types type) {
+	switch (type) {
+		case kernel_types::SCALAR: return "scalar";
+		case kernel_types::SSE: return "sse";
+		case kernel_types::NEON: return "neon";
+		case kernel_types::AVX2: return "avx2";
+		default: return "unknown";
+	}
+}
+
+void fast_normalize(float& x, float& y) {
+	float mag2 = x*x + y*y;
+	if (mag2 == 0.0f) {
+		return;
+	}
+	// Estimate plus one Newton step is plenty for steering.
+#if defined(KERNEL_X86)
+	float inv = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(mag2)));
+	inv = inv * (1.5f - 0.5f * mag2 * inv * inv);
+#elif defined(KERNEL_NEON)
+	float inv = vrsqrtes_f32(mag2);
+	inv = inv * vrsqrtss_f32(mag2 * inv, inv);
+#else
+	float inv = 1.0f / std::sqrt(mag2);
+#endif
+	x *= inv;
+	y *= inv;
+}
+
+bool is_finite(float value) {
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return (bits & 0x7f800000u) != 0x7f800000u;
+}
+
+bool is_finite(double value) {
+	uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return (bits & 0x7ff0000000000000ull) != 0x7ff0000000000000ull;
+}
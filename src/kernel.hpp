@@ -0,0 +1,85 @@
+// Kernel.h
+// Vectorized flocking kernel for separation, alignment and cohesion.
+// There are AVX2, SSE2 and NEON versions plus a scalar fallback,
+// the best one for the CPU is picked at runtime.
+
+#ifndef _KERNEL_H_
+#define _KERNEL_H_
+
+#include <vector>
+
+// Candidates handled per loop iteration. The neighbor arrays
+// are padded by this much so wide loads never run off the end.
+constexpr int KERNEL_WIDTH = 8;
+
+// Species ids fit a byte, but the kernel reads them as one
+// lane each, so a species row fits a single AVX2 register.
+constexpr int MAX_SPECIES = 8;
+
+// Cell-sorted copy of the flock positions and directions.
+// Slot s holds the boid index[s], so each grid row is a contiguous range.
+struct NeighborData {
+	std::vector<float> x, y;
+	std::vector<float> dx, dy;
+	std::vector<int> index;
+	std::vector<int> species;
+
+	// Resizes to size slots plus padding.
+	void resize(int size);
+	int size() const;
+};
+
+// Running neighbor sums for one boid.
+struct FlockSums {
+	// Distance weighted offsets away from neighbors.
+	float sep_x, sep_y;
+	// Sum of neighbor directions.
+	float align_x, align_y;
+	// Weighted sum of neighbor positions, and the sum of the weights.
+	float coh_x, coh_y;
+	float coh_weight;
+	int count;
+};
+
+// How one species reacts to a neighbor of each species.
+// Multiplies that neighbor's separation, alignment and cohesion terms,
+// a negative cohesion steers away from it (prey fleeing a predator).
+struct InteractionRow {
+	float separate[MAX_SPECIES];
+	float align[MAX_SPECIES];
+	float cohede[MAX_SPECIES];
+};
+
+// Adds every neighbor in slots [begin, end) that is closer than radius
+// to (px, py) and isn't the boid self, to sums.
+// With a p_row, each neighbor is weighted by its species' entries,
+// a null p_row weights everything by 1 (one species, the fast path).
+using flock_kernel = void (*)(const NeighborData& data, int begin, int end,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums);
+
+// Same, but for the candidates in slots[0, count) of data, in any
+// order, as for neighbor lists. data.index isn't read, the slot is the id.
+using slot_kernel = void (*)(const NeighborData& data, const int* slots, int count,
+	float px, float py, int self, float radius, const InteractionRow* p_row,
+	FlockSums& sums);
+
+enum class kernel_types { SCALAR, SSE, NEON, AVX2 };
+
+// Kernel selection.
+kernel_types best_kernel_type(); // Checks CPU features.
+bool kernel_supported(kernel_types type);
+flock_kernel get_kernel(kernel_types type);
+slot_kernel get_slot_kernel(kernel_types type);
+const char* kernel_name(kernel_types type);
+
+// Normalizes (x, y) with one reciprocal square root.
+// Zero vectors are left alone.
+void fast_normalize(float& x, float& y);
+
+// Whether value is neither NaN nor inf. We build with -Ofast, which
+// folds std::isfinite() to true, so these look at the exponent bits.
+bool is_finite(float value);
+bool is_finite(double value);
+
+#endif
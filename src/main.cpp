@@ -13,11 +13,50 @@
 #include "classes.hpp"
 #include "initialize.hpp"
 #include "wrappers.hpp"
+#include "obstacles.hpp"
+#include "snapshot.hpp"
+#include "simthread.hpp"
+#include "profiler.hpp"
+#include "camera.hpp"
+
+// Below this zoom boids are a pixel or two,
+// so the density of each cell is drawn instead.
+constexpr float SPLAT_ZOOM = 0.25f;
+
+// Boid tint per species.
+const SDL_Color SPECIES_TINTS[MAX_SPECIES] = {
+	{0xFF, 0xFF, 0xFF, 0xFF}, {0xFF, 0x60, 0x50, 0xFF},
+	{0x60, 0xC0, 0xFF, 0xFF}, {0x80, 0xFF, 0x80, 0xFF},
+	{0xFF, 0xE0, 0x60, 0xFF}, {0xD0, 0x80, 0xFF, 0xFF},
+	{0x60, 0xFF, 0xE0, 0xFF}, {0xFF, 0xA0, 0xD0, 0xFF}
+};
 
 // Helper function.
-void handle_events(SDL_Event* p_ev, ObstacleGroup* p_obs, Flightspace* p_flock);
+void handle_events(SDL_Event* p_ev, ObstacleGroup* p_obs, FieldGroup* p_fields,
+	Flightspace* p_flock);
+bool load_obstacle_map(const std::string& path, ObstacleGroup* p_obs);
+void set_slider_value(Slider* p_slider, float value);
+void draw_profiler_hud();
+void draw_density(const DensityFrame& density);
+void draw_fields(const FieldGroup& fields);
+bool is_config_path(const std::string& path);
+
+// Profiler overlay toggle.
+bool g_show_hud = false;
+// The part of the world on screen.
+Camera g_camera;
 
 int main(int argc, char* args[]) {
+	// A .cfg argument sets the screen, world and flock sizes,
+	// so it has to be read before the window exists.
+	for (int i = 1; i < argc; i++) {
+		if (is_config_path(args[i]) && !load_config(args[i], &g_config)) {
+			return 1;
+		}
+	}
+
+	g_camera.set_screen(g_config.screen_w, g_config.screen_h);
+
 	// Try initializing everything.
 	if (try_init()) {
 		// Main loop flag.
@@ -25,69 +64,124 @@ int main(int argc, char* args[]) {
 		SDL_Event event;
 		Flightspace my_flock;
 		ObstacleGroup my_obs_group;
+		FieldGroup my_fields;
 
 		// Populate the flock.
-		my_flock.random_populate(NUM_BOIDS, SCR_W, SCR_H, 3.25, 0.3);
-		my_flock.set_obstacles(my_obs_group.get_obstacles());
+		apply_config(g_config, &my_flock);
+		populate(g_config, &my_flock);
+		my_flock.set_obstacles(&my_obs_group);
+		my_flock.set_fields(&my_fields);
+
+		// Any other argument is an obstacle map.
+		for (int i = 1; i < argc; i++) {
+			if (!is_config_path(args[i])) {
+				load_obstacle_map(args[i], &my_obs_group);
+			}
+		}
+
+		// The flock steps on its own thread at sim_rate,
+		// we only draw whatever it last published.
+		SimThread my_sim(&my_flock, g_config.sim_rate);
+		RenderFrame frame;
+		DensityFrame density;
+		std::vector<int> visible_obstacles;
+		my_sim.start();
 
 		while (program_active) {
             // Try playing next song without forcing.
 			g_playlist->next_song(false);
 
 			// Handle queued events.
-			while (SDL_PollEvent(&event) != 0) {
-				if (event.type == SDL_QUIT) {
-					program_active = false;
+			// Events change obstacles and the flock, so the sim waits.
+			{
+				ProfileScope scope("events");
+				std::lock_guard<std::mutex> lock(my_sim.get_mutex());
+				while (SDL_PollEvent(&event) != 0) {
+					if (event.type == SDL_QUIT) {
+						program_active = false;
+					}
+					handle_events(&event, &my_obs_group, &my_fields, &my_flock);
 				}
-				handle_events(&event, &my_obs_group, &my_flock);
-			}
 
-			// Clear screen.
-			SDL_SetRenderDrawColor(g_renderer, 0x1F, 0x1F, 0x1F, 0xFF);
-			SDL_RenderClear(g_renderer);
-
-			// Update all the movement vectors prior to moving.
-			my_flock.update();
-
-			// Render boids.
-			for (int i = 0; i < my_flock.get_size(); i++) {
-				Boid* p_boid = my_flock.get_boid(i);
-				p_boid->move();
-				p_boid->bind_position(-20, SCR_W+20, -20, SCR_H+20);
-				Vector2 position = p_boid->get_pos();
-				g_tex_boid->render_at(position.x, position.y,
-					p_boid->get_rotation(), g_renderer, 2);
+				// Change the change_behaviour based on sliders.
+				Boid::change_behaviour(
+					g_slider_separation->get_current_value(),
+					g_slider_alignment->get_current_value(),
+					g_slider_cohesion->get_current_value(),
+					Boid::m_avoid);
 			}
 
-			// Render obstacles.
-			for (int i = 0; i < my_obs_group.get_size(); i++) {
-				Vector2* obstacle = my_obs_group.get_obstacles()->at(i);
-				g_tex_obstacle->render_at(obstacle->x,
-					obstacle->y, 0.0, g_renderer);
-			}
+			// Everything up to the present.
+			{
+				ProfileScope scope("render submit");
+
+				// Clear screen.
+				SDL_SetRenderDrawColor(g_renderer, 0x1F, 0x1F, 0x1F, 0xFF);
+				SDL_RenderClear(g_renderer);
 
-            // Change the change_behaviour based on sliders.
-            Boid::change_behaviour(
-                g_slider_separation->get_current_value(),
-                g_slider_alignment->get_current_value(),
-                g_slider_cohesion->get_current_value(),
-                Boid::m_avoid);
+				// Render boids, one draw call for the ones on screen.
+				WorldBounds view = g_camera.get_view();
+				float zoom = g_camera.get_zoom();
+				if (zoom < SPLAT_ZOOM) {
+					my_sim.get_density(density, view);
+					draw_density(density);
+				}
+				else {
+					my_sim.get_frame(frame, view);
+					g_boid_batch->set_scale(zoom);
+					g_boid_batch->build(frame.x.size(), [&](int i) {
+						g_boid_batch->set_sprite(i, g_camera.to_screen_x(frame.x[i]),
+							g_camera.to_screen_y(frame.y[i]), frame.dx[i], frame.dy[i],
+							SPECIES_TINTS[frame.species[i] % MAX_SPECIES]);
+					});
+					g_boid_batch->render(g_renderer);
+				}
 
-			// Draw vignette
-			g_tex_vignette->render_at(0, 0, 0.0, g_renderer);
+				// Render obstacles on screen.
+				// Sprites hang right and down from their point, so obstacles
+				// up to a sprite size left of or above the view still show.
+				const BucketGrid* p_obs_index = my_obs_group.get_index();
+				float obs_w = g_tex_obstacle->get_w(), obs_h = g_tex_obstacle->get_h();
+				visible_obstacles.clear();
+				p_obs_index->query_rect(view.xmin - obs_w, view.ymin - obs_h, view.xmax, view.ymax,
+				[&](int i) {
+					visible_obstacles.push_back(i);
+				});
+				g_obstacle_batch->set_scale(zoom);
+				g_obstacle_batch->build(visible_obstacles.size(), [&](int k) {
+					int i = visible_obstacles[k];
+					g_obstacle_batch->set_sprite(k, g_camera.to_screen_x(p_obs_index->get_x(i)),
+						g_camera.to_screen_y(p_obs_index->get_y(i)));
+				});
+				g_obstacle_batch->render(g_renderer);
+				// Only we change the fields, so no lock to read them.
+				draw_fields(my_fields);
 
-			// Draw text
-			g_titlebox->show_text_at(10, 10, 0.0, g_renderer);
-			g_textbox->show_text_at(25, 40, 0.0, g_renderer);
+				// Draw vignette
+				g_tex_vignette->render_at(0, 0, 0.0, g_renderer);
 
-            // Draw sliders
-            g_slider_cohesion->render_parts(g_renderer, "Cohesion = ");
-            g_slider_alignment->render_parts(g_renderer, "Alignment = ");
-            g_slider_separation->render_parts(g_renderer, "Separation = ");
+				// Draw text
+				g_titlebox->show_text_at(10, 10, 0.0, g_renderer);
+				g_textbox->show_text_at(25, 40, 0.0, g_renderer);
+
+				// Draw sliders
+				g_slider_cohesion->render_parts(g_renderer, "Cohesion = ");
+				g_slider_alignment->render_parts(g_renderer, "Alignment = ");
+				g_slider_separation->render_parts(g_renderer, "Separation = ");
+
+				if (g_show_hud) {
+					draw_profiler_hud();
+				}
+			}
 
 			// Update screen.
-			SDL_RenderPresent(g_renderer);
+			{
+				ProfileScope scope("present");
+				SDL_RenderPresent(g_renderer);
+			}
+			Profiler::get().end_frame();
 		}
+		my_sim.stop();
 	}
 
 	// Close SDL subsystems.
@@ -95,10 +189,93 @@ int main(int argc, char* args[]) {
 	return 0;
 }
 
+// Images become obstacle masks, everything else goes to the file loaders.
+bool load_obstacle_map(const std::string& path, ObstacleGroup* p_obs) {
+	std::string extension = path.substr(path.find_last_of('.') + 1);
+	if (extension == "png" || extension == "PNG" || extension == "bmp") {
+		std::vector<float> xs, ys;
+		if (!load_mask_points(path, xs, ys)) {
+			return false;
+		}
+		p_obs->add_obstacles(xs.data(), ys.data(), xs.size());
+		return true;
+	}
+	return load_obstacles(path, p_obs);
+}
+
+bool is_config_path(const std::string& path) {
+	return path.size() > 4 && path.substr(path.size() - 4) == ".cfg";
+}
+
+// Rolling phase times and counters, top right.
+void draw_profiler_hud() {
+	if (!g_hud_box->has_atlas() && !g_hud_box->load_atlas(g_renderer)) {
+		return;
+	}
+	int line_h = g_hud_box->get_glyphs_h();
+	std::vector<std::string> lines = Profiler::get().summary();
+	for (int i = 0; i < (int)lines.size(); i++) {
+		int width = g_hud_box->get_glyphs_w(lines[i]);
+		g_hud_box->show_glyphs_at(g_config.screen_w - width - 10, 10 + i * line_h,
+			lines[i], g_renderer);
+	}
+}
+
+// One rectangle per non-empty cell, brighter the more boids it has.
+void draw_density(const DensityFrame& density) {
+	int cells = 0;
+	for (int count : density.counts) {
+		cells += (count > 0);
+	}
+	g_density_batch->resize(cells);
+	float size = density.cellsize * g_camera.get_zoom();
+	int rect = 0;
+	for (int cy = 0; cy < density.rows; cy++) {
+		for (int cx = 0; cx < density.cols; cx++) {
+			int count = density.counts[cy * density.cols + cx];
+			if (count == 0) {
+				continue;
+			}
+			Uint8 alpha = std::min(255, 24 + count * 16);
+			g_density_batch->set_rect(rect++,
+				g_camera.to_screen_x(density.xmin + cx * density.cellsize),
+				g_camera.to_screen_y(density.ymin + cy * density.cellsize),
+				size, size, SDL_Color{0xE6, 0xE6, 0xFF, alpha});
+		}
+	}
+	g_density_batch->render(g_renderer);
+}
+
+// A small square at each field's center,
+// green for attractors and red for the rest.
+void draw_fields(const FieldGroup& fields) {
+	g_field_batch->resize(fields.get_size());
+	for (int i = 0; i < fields.get_size(); i++) {
+		Vector2 position = fields.get_position(i);
+		SDL_Color color = (fields.get_strength(i) > 0 && !fields.is_flow(i))?
+			SDL_Color{0x60, 0xFF, 0x80, 0xC0} : SDL_Color{0xFF, 0x60, 0x50, 0xC0};
+		g_field_batch->set_rect(i, g_camera.to_screen_x(position.x) - 4,
+			g_camera.to_screen_y(position.y) - 4, 8, 8, color);
+	}
+	g_field_batch->render(g_renderer);
+}
+
+// Sliders take percentages, not values.
+void set_slider_value(Slider* p_slider, float value) {
+	float range = p_slider->max_output - p_slider->min_output;
+	p_slider->set_current_value(100.0f * (value - p_slider->min_output) / range);
+}
+
 // Ugly asf way to organize code lol
-void handle_events(SDL_Event* p_ev, ObstacleGroup* p_obs, Flightspace* p_flock) {
+void handle_events(SDL_Event* p_ev, ObstacleGroup* p_obs, FieldGroup* p_fields,
+	Flightspace* p_flock)
+{
     int mouse_x = p_ev->button.x;
     int mouse_y = p_ev->button.y;
+	// Key events don't carry the cursor.
+	if (p_ev->type == SDL_KEYDOWN) {
+		SDL_GetMouseState(&mouse_x, &mouse_y);
+	}
 	switch(p_ev->type) {
 		case SDL_KEYDOWN:
 			switch(p_ev->key.keysym.sym) {
@@ -113,6 +290,45 @@ void handle_events(SDL_Event* p_ev, ObstacleGroup* p_obs, Flightspace* p_flock)
 					SFX::global_volume(64); // Unmute
 					g_playlist->resume_playback();
 					break;
+				case SDLK_p:
+					// Only profile while someone is looking.
+					g_show_hud = !g_show_hud;
+					Profiler::get().set_enabled(g_show_hud);
+					break;
+				// Camera.
+				case SDLK_LEFT: g_camera.pan(-50, 0); break;
+				case SDLK_RIGHT: g_camera.pan(50, 0); break;
+				case SDLK_UP: g_camera.pan(0, -50); break;
+				case SDLK_DOWN: g_camera.pan(0, 50); break;
+				case SDLK_HOME: g_camera.reset(); break;
+				// Force fields under the cursor.
+				case SDLK_a:
+					p_fields->add_point(g_camera.to_world_x(mouse_x),
+						g_camera.to_world_y(mouse_y), 150.0f, 2.0f);
+					break;
+				case SDLK_d:
+					p_fields->add_point(g_camera.to_world_x(mouse_x),
+						g_camera.to_world_y(mouse_y), 150.0f, -3.0f);
+					break;
+				case SDLK_c:
+					p_fields->clear_all();
+					break;
+				case SDLK_t:
+					if (Profiler::get().write_chrome_trace("trace.json")) {
+						std::cout << "Wrote trace.json\n";
+					}
+					break;
+				case SDLK_s:
+					save_snapshot("flock.snap", *p_flock, p_obs);
+					break;
+				case SDLK_l:
+					if (load_snapshot("flock.snap", p_flock, p_obs)) {
+						// Put the sliders where the loaded weights are.
+						set_slider_value(g_slider_separation, Boid::m_separate);
+						set_slider_value(g_slider_alignment, Boid::m_align);
+						set_slider_value(g_slider_cohesion, Boid::m_cohede);
+					}
+					break;
 				default: break;
 			}
 			break;
@@ -128,12 +344,14 @@ void handle_events(SDL_Event* p_ev, ObstacleGroup* p_obs, Flightspace* p_flock)
                         (g_slider_separation->get_state() != Slider::button_states::HELD))
                     {
                         // Add if ui is not clicked.
-                        p_obs->add_obstacle(mouse_x, mouse_y);
+                        p_obs->add_obstacle(g_camera.to_world_x(mouse_x),
+                            g_camera.to_world_y(mouse_y));
                     }
 					g_click_sfx->play();
 					break;
 				case SDL_BUTTON_RIGHT:
-					p_obs->remove_obstacles(mouse_x, mouse_y);
+					p_obs->remove_obstacles(g_camera.to_world_x(mouse_x),
+						g_camera.to_world_y(mouse_y));
 					g_click_sfx->play();
 					break;
 				default: break;
@@ -149,6 +367,25 @@ void handle_events(SDL_Event* p_ev, ObstacleGroup* p_obs, Flightspace* p_flock)
                 default: break;
             }
             break;
+		case SDL_MOUSEWHEEL: {
+			// Zoom about the cursor.
+			if (p_ev->wheel.y == 0) {
+				break;
+			}
+			int cursor_x, cursor_y;
+			SDL_GetMouseState(&cursor_x, &cursor_y);
+			g_camera.zoom_at((p_ev->wheel.y > 0)? 1.25f : 0.8f, cursor_x, cursor_y);
+			break;
+		}
+		case SDL_MOUSEMOTION:
+			// Middle mouse drag pans.
+			if (p_ev->motion.state & SDL_BUTTON_MMASK) {
+				g_camera.pan(-p_ev->motion.xrel, -p_ev->motion.yrel);
+			}
+			g_slider_cohesion->process_ui(p_ev->motion.x, p_ev->motion.y);
+			g_slider_alignment->process_ui(p_ev->motion.x, p_ev->motion.y);
+			g_slider_separation->process_ui(p_ev->motion.x, p_ev->motion.y);
+			break;
 		default:
             g_slider_cohesion->process_ui(mouse_x, mouse_y);
             g_slider_alignment->process_ui(mouse_x, mouse_y);
@@ -0,0 +1,68 @@
+// Mapped.cpp
+// Member function definitions for MappedFile.
+
+#include "mapped.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile():
+	_m_fd(-1),
+	_mp_data(nullptr),
+	_m_size(0)
+{}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(const std::string& path) {
+	close();
+	_m_fd = ::open(path.c_str(), O_RDONLY);
+	if (_m_fd < 0) {
+		return false;
+	}
+	struct stat info;
+	if (fstat(_m_fd, &info) != 0) {
+		close();
+		return false;
+	}
+	_m_size = info.st_size;
+	// mmap doesn't take zero lengths.
+	if (_m_size > 0) {
+		void* p_map = mmap(nullptr, _m_size, PROT_READ, MAP_PRIVATE, _m_fd, 0);
+		if (p_map == MAP_FAILED) {
+			close();
+			return false;
+		}
+		_mp_data = static_cast<const char*>(p_map);
+		// We read front to back.
+		madvise(p_map, _m_size, MADV_SEQUENTIAL);
+	}
+	return true;
+}
+
+void MappedFile::close() {
+	if (_mp_data != nullptr) {
+		munmap(const_cast<char*>(_mp_data), _m_size);
+		_mp_data = nullptr;
+	}
+	if (_m_fd >= 0) {
+		::close(_m_fd);
+		_m_fd = -1;
+	}
+	_m_size = 0;
+}
+
+bool MappedFile::is_open() const {
+	return _m_fd >= 0;
+}
+
+const char* MappedFile::data() const {
+	return _mp_data;
+}
+
+size_t MappedFile::size() const {
+	return _m_size;
+}
@@ -0,0 +1,31 @@
+// Mapped.h
+// Read-only memory mapped files, so big files can be
+// read straight from the page cache without copying them in.
+
+#ifndef _MAPPED_H_
+#define _MAPPED_H_
+
+#include <string>
+#include <cstddef>
+
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Maps the whole file, an empty file maps to size() == 0.
+	bool open(const std::string& path);
+	void close();
+
+	bool is_open() const;
+	const char* data() const;
+	size_t size() const;
+private:
+	int _m_fd;
+	const char* _mp_data;
+	size_t _m_size;
+};
+
+#endif
@@ -0,0 +1,173 @@
+// Obstacles.cpp
+// Obstacle file loaders.
+
+#include "obstacles.hpp"
+#include "mapped.hpp"
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+static const char OBSTACLE_MAGIC[4] = {'B', 'O', 'B', 'S'};
+static const uint32_t OBSTACLE_VERSION = 1;
+
+// NaN or inf would reach the float to int casts of the grid.
+static bool all_finite(const float* xs, const float* ys, size_t count,
+	const std::string& path)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (!is_finite(xs[i]) || !is_finite(ys[i])) {
+			std::cout << "Obstacle file " << path << " has a point that isn't a number\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+bool load_obstacles(const std::string& path, ObstacleGroup* p_group) {
+	std::string extension = path.substr(path.find_last_of('.') + 1);
+	if (extension == "csv" || extension == "CSV") {
+		return load_obstacles_csv(path, p_group);
+	}
+	return load_obstacles_binary(path, p_group);
+}
+
+bool load_obstacles_binary(const std::string& path, ObstacleGroup* p_group) {
+	MappedFile file;
+	if (!file.open(path)) {
+		std::cout << "Unable to open obstacle file " << path << "\n";
+		return false;
+	}
+
+	ObstacleFileHeader header;
+	if (file.size() < sizeof(header)) {
+		std::cout << "Obstacle file " << path << " is too short\n";
+		return false;
+	}
+	std::memcpy(&header, file.data(), sizeof(header));
+	if (std::memcmp(header.magic, OBSTACLE_MAGIC, 4) != 0 ||
+		header.version != OBSTACLE_VERSION)
+	{
+		std::cout << "Obstacle file " << path << " has the wrong format\n";
+		return false;
+	}
+	// add_obstacles() takes an int count.
+	if (header.count > INT_MAX) {
+		std::cout << "Obstacle file " << path << " has too many obstacles\n";
+		return false;
+	}
+	if (file.size() < sizeof(header) + 2 * sizeof(float) * (size_t)header.count) {
+		std::cout << "Obstacle file " << path << " is truncated\n";
+		return false;
+	}
+
+	// The header keeps the arrays 4-byte aligned in the page aligned map.
+	const float* xs = reinterpret_cast<const float*>(file.data() + sizeof(header));
+	const float* ys = xs + header.count;
+	if (!all_finite(xs, ys, header.count, path)) {
+		return false;
+	}
+	p_group->add_obstacles(xs, ys, header.count);
+	return true;
+}
+
+// Reads a plain decimal number (-12.5, 3e2) and moves p past it.
+static bool parse_float(const char*& p, const char* end, float& out) {
+	while (p < end && (*p == ' ' || *p == '\t')) { p++; }
+	const char* start = p;
+	double sign = 1.0;
+	if (p < end && (*p == '-' || *p == '+')) {
+		sign = (*p == '-')? -1.0 : 1.0;
+		p++;
+	}
+	double value = 0.0;
+	int digits = 0, exponent = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		value = value * 10.0 + (*p++ - '0');
+		digits++;
+	}
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && *p >= '0' && *p <= '9') {
+			value = value * 10.0 + (*p++ - '0');
+			exponent--;
+			digits++;
+		}
+	}
+	if (digits == 0) {
+		p = start;
+		return false;
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char* mark = p++;
+		int exp_sign = 1, exp_value = 0;
+		if (p < end && (*p == '-' || *p == '+')) {
+			exp_sign = (*p == '-')? -1 : 1;
+			p++;
+		}
+		if (p < end && *p >= '0' && *p <= '9') {
+			while (p < end && *p >= '0' && *p <= '9') {
+				exp_value = exp_value * 10 + (*p++ - '0');
+			}
+			exponent += exp_sign * exp_value;
+		}
+		else {
+			p = mark; // Not an exponent after all.
+		}
+	}
+	out = (float)(sign * value * std::pow(10.0, exponent));
+	return true;
+}
+
+bool load_obstacles_csv(const std::string& path, ObstacleGroup* p_group) {
+	MappedFile file;
+	if (!file.open(path)) {
+		std::cout << "Unable to open obstacle file " << path << "\n";
+		return false;
+	}
+
+	std::vector<float> xs, ys;
+	const char* p = file.data();
+	const char* end = p + file.size();
+	while (p < end) {
+		const char* line_end = static_cast<const char*>(
+			std::memchr(p, '\n', end - p));
+		if (line_end == nullptr) { line_end = end; }
+
+		float x, y;
+		if (parse_float(p, line_end, x)) {
+			while (p < line_end && (*p == ' ' || *p == '\t')) { p++; }
+			if (p < line_end && (*p == ',' || *p == ';')) { p++; }
+			if (parse_float(p, line_end, y)) {
+				xs.push_back(x);
+				ys.push_back(y);
+			}
+		}
+		p = line_end + 1;
+	}
+
+	if (!all_finite(xs.data(), ys.data(), xs.size(), path)) {
+		return false;
+	}
+	p_group->add_obstacles(xs.data(), ys.data(), xs.size());
+	return true;
+}
+
+bool save_obstacles_binary(const std::string& path, const ObstacleGroup& group) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		std::cout << "Unable to write obstacle file " << path << "\n";
+		return false;
+	}
+	const BucketGrid* p_index = group.get_index();
+	ObstacleFileHeader header = {{'B', 'O', 'B', 'S'}, OBSTACLE_VERSION,
+		(uint32_t)p_index->size(), 0};
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(p_index->get_xs()),
+		sizeof(float) * p_index->size());
+	file.write(reinterpret_cast<const char*>(p_index->get_ys()),
+		sizeof(float) * p_index->size());
+	return (bool)file;
+}
@@ -0,0 +1,35 @@
+// Obstacles.h
+// Loading and saving obstacle sets, so flocks can run through
+// maps with far more obstacles than anyone wants to click in.
+// Image masks are loaded in wrappers.h, this side doesn't need SDL.
+
+#ifndef _OBSTACLES_H_
+#define _OBSTACLES_H_
+
+#include "classes.hpp"
+#include <string>
+#include <cstdint>
+
+// Binary obstacle file: this header, then count x floats and then
+// count y floats, little endian. The floats are read straight out
+// of the mapped file.
+struct ObstacleFileHeader {
+	char magic[4]; // "BOBS"
+	uint32_t version;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+// Picks the format from the extension (.csv, anything else is binary).
+// Obstacles are added to whatever the group already has.
+bool load_obstacles(const std::string& path, ObstacleGroup* p_group);
+bool load_obstacles_binary(const std::string& path, ObstacleGroup* p_group);
+// One "x,y" per line, lines that aren't two numbers (headers,
+// # comments) are skipped.
+bool load_obstacles_csv(const std::string& path, ObstacleGroup* p_group);
+
+// Writes the group in the binary format, boids_headless --save-obstacles
+// uses it to turn csv or image maps into files that load straight away.
+bool save_obstacles_binary(const std::string& path, const ObstacleGroup& group);
+
+#endif
@@ -0,0 +1,218 @@
+// Profiler.cpp
+// Member function definitions for Profiler and ProfileScope.
+
+#include "profiler.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+// How much each new frame moves the rolling stats.
+static const double SMOOTHING = 0.05;
+
+static const char* counter_name(int counter) {
+	switch ((profile_counters)counter) {
+		case profile_counters::NEIGHBOR_VISITS: return "neighbor visits/s";
+		case profile_counters::OBSTACLE_VISITS: return "obstacle visits/s";
+		case profile_counters::FIELD_VISITS: return "field visits/s";
+		default: return "?";
+	}
+}
+
+Profiler& Profiler::get() {
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Profiler():
+	_m_enabled(false),
+	_m_epoch(std::chrono::steady_clock::now()),
+	_m_last_frame_ns(0)
+{
+	for (int c = 0; c < _M_NUM_COUNTERS; c++) {
+		_m_counter_rates[c] = 0.0;
+	}
+}
+
+void Profiler::set_enabled(bool enabled) {
+	_m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Profiler::is_enabled() const {
+	return _m_enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t Profiler::now_ns() const {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - _m_epoch).count();
+}
+
+// Made the first time a thread records anything, and kept
+// after it exits so its spans still show up in the trace.
+Profiler::ThreadLog* Profiler::thread_log() {
+	thread_local ThreadLog* tp_log = nullptr;
+	if (tp_log == nullptr) {
+		std::unique_ptr<ThreadLog> p_log(new ThreadLog());
+		p_log->events.resize(_M_RING_SIZE);
+		p_log->head = 0;
+		p_log->read = 0;
+		for (int c = 0; c < _M_NUM_COUNTERS; c++) {
+			p_log->counters[c] = 0;
+			p_log->last_counters[c] = 0;
+		}
+		std::lock_guard<std::mutex> lock(_m_mutex);
+		p_log->thread = _m_logs.size();
+		tp_log = p_log.get();
+		_m_logs.push_back(std::move(p_log));
+	}
+	return tp_log;
+}
+
+void Profiler::record(const char* name, uint64_t start_ns, uint64_t end_ns) {
+	if (!is_enabled()) {
+		return;
+	}
+	ThreadLog* p_log = thread_log();
+	uint64_t head = p_log->head.load(std::memory_order_relaxed);
+	p_log->events[head % _M_RING_SIZE] = {name, start_ns, end_ns};
+	// Readers only look below head.
+	p_log->head.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::count(profile_counters counter, uint64_t amount) {
+	if (!is_enabled()) {
+		return;
+	}
+	// Single writer, so no read-modify-write needed.
+	std::atomic<uint64_t>& total = thread_log()->counters[(int)counter];
+	total.store(total.load(std::memory_order_relaxed) + amount,
+		std::memory_order_relaxed);
+}
+
+void Profiler::end_frame() {
+	if (!is_enabled()) {
+		return;
+	}
+	uint64_t now = now_ns();
+	std::lock_guard<std::mutex> lock(_m_mutex);
+	double seconds = (_m_last_frame_ns > 0)? (now - _m_last_frame_ns) * 1e-9 : 0.0;
+	_m_last_frame_ns = now;
+
+	std::vector<FrameTotals>& frame = _m_frame;
+	frame.clear();
+	uint64_t counts[_M_NUM_COUNTERS] = {};
+	for (std::unique_ptr<ThreadLog>& p_log : _m_logs) {
+		uint64_t head = p_log->head.load(std::memory_order_acquire);
+		// Anything older than a ring is gone.
+		uint64_t first = std::max(p_log->read, (head > _M_RING_SIZE)? head - _M_RING_SIZE : 0);
+		for (uint64_t e = first; e < head; e++) {
+			const ProfileEvent& event = p_log->events[e % _M_RING_SIZE];
+			double ms = (event.end_ns - event.start_ns) * 1e-6;
+			auto found = std::find_if(frame.begin(), frame.end(),
+				[&](const FrameTotals& f) { return std::strcmp(f.name, event.name) == 0; });
+			if (found == frame.end()) {
+				frame.push_back({event.name, ms, ms, 1});
+			}
+			else {
+				found->total_ms += ms;
+				found->max_ms = std::max(found->max_ms, ms);
+				found->spans++;
+			}
+		}
+		p_log->read = head;
+		for (int c = 0; c < _M_NUM_COUNTERS; c++) {
+			uint64_t total = p_log->counters[c].load(std::memory_order_relaxed);
+			counts[c] += total - p_log->last_counters[c];
+			p_log->last_counters[c] = total;
+		}
+	}
+
+	for (const FrameTotals& f : frame) {
+		double mean = f.total_ms / f.spans;
+		auto found = std::find_if(_m_phases.begin(), _m_phases.end(),
+			[&](const ProfilePhase& p) { return std::strcmp(p.name, f.name) == 0; });
+		if (found == _m_phases.end()) {
+			_m_phases.push_back({f.name, mean, f.max_ms});
+		}
+		else {
+			found->mean_ms += (mean - found->mean_ms) * SMOOTHING;
+			found->max_ms = f.max_ms;
+		}
+	}
+	if (seconds > 0.0) {
+		for (int c = 0; c < _M_NUM_COUNTERS; c++) {
+			_m_counter_rates[c] += (counts[c] / seconds - _m_counter_rates[c]) * SMOOTHING;
+		}
+	}
+}
+
+std::vector<ProfilePhase> Profiler::get_phase_stats() const {
+	std::lock_guard<std::mutex> lock(_m_mutex);
+	return _m_phases;
+}
+
+double Profiler::get_counter_rate(profile_counters counter) const {
+	std::lock_guard<std::mutex> lock(_m_mutex);
+	return _m_counter_rates[(int)counter];
+}
+
+std::vector<std::string> Profiler::summary() const {
+	std::vector<std::string> lines;
+	for (const ProfilePhase& phase : get_phase_stats()) {
+		std::ostringstream line;
+		line << std::fixed << std::setprecision(2) << phase.name << "  "
+			<< phase.mean_ms << " ms (max " << phase.max_ms << ")";
+		lines.push_back(line.str());
+	}
+	for (int c = 0; c < _M_NUM_COUNTERS; c++) {
+		std::ostringstream line;
+		line << std::fixed << std::setprecision(2) << counter_name(c) << "  "
+			<< get_counter_rate((profile_counters)c) * 1e-6 << "M";
+		lines.push_back(line.str());
+	}
+	return lines;
+}
+
+bool Profiler::write_chrome_trace(const std::string& path) const {
+	std::ofstream file(path);
+	if (!file) {
+		return false;
+	}
+	// Complete ("X") events, times in microseconds.
+	file << "{\"traceEvents\": [\n";
+	bool first = true;
+	std::lock_guard<std::mutex> lock(_m_mutex);
+	for (const std::unique_ptr<ThreadLog>& p_log : _m_logs) {
+		uint64_t head = p_log->head.load(std::memory_order_acquire);
+		uint64_t oldest = (head > _M_RING_SIZE)? head - _M_RING_SIZE : 0;
+		for (uint64_t e = oldest; e < head; e++) {
+			const ProfileEvent& event = p_log->events[e % _M_RING_SIZE];
+			file << (first? "" : ",\n") << "  {\"name\": \"" << event.name
+				<< "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << p_log->thread
+				<< std::fixed << std::setprecision(3)
+				<< ", \"ts\": " << event.start_ns * 1e-3
+				<< ", \"dur\": " << (event.end_ns - event.start_ns) * 1e-3 << "}";
+			first = false;
+		}
+	}
+	file << "\n]}\n";
+	return (bool)file;
+}
+
+// Member function definitions for ProfileScope.
+ProfileScope::ProfileScope(const char* name):
+	_mp_name(name),
+	_m_start(0)
+{
+	if (Profiler::get().is_enabled()) {
+		_m_start = Profiler::get().now_ns();
+	}
+}
+
+ProfileScope::~ProfileScope() {
+	// Profiling was off (or just turned on) when we started.
+	if (_m_start != 0) {
+		Profiler::get().record(_mp_name, _m_start, Profiler::get().now_ns());
+	}
+}
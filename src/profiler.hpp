@@ -0,0 +1,106 @@
+// Profiler.h
+// Tiny built-in profiler: scoped timers and counters that go into
+// per-thread ring buffers, rolling per-phase stats for an on-screen
+// HUD, and Chrome trace export (load it in chrome://tracing or Perfetto).
+// Off by default, and close to free while off.
+
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class profile_counters {
+	NEIGHBOR_VISITS, // Candidate boids looked at by the rules.
+	OBSTACLE_VISITS, // Candidate obstacles looked at.
+	FIELD_VISITS,    // Candidate force fields looked at.
+	NUM_COUNTERS
+};
+
+// One timed span, names must be string literals.
+struct ProfileEvent {
+	const char* name;
+	uint64_t start_ns, end_ns;
+};
+
+// Rolling stats for one phase name.
+struct ProfilePhase {
+	const char* name;
+	double mean_ms; // Smoothed duration per span.
+	double max_ms;  // Longest span since the last end_frame().
+};
+
+class Profiler {
+public:
+	// The one profiler everything records into.
+	static Profiler& get();
+
+	void set_enabled(bool enabled);
+	bool is_enabled() const;
+
+	uint64_t now_ns() const;
+	void record(const char* name, uint64_t start_ns, uint64_t end_ns);
+	void count(profile_counters counter, uint64_t amount);
+
+	// Folds what was recorded since the last call into the rolling
+	// stats, call once per rendered frame.
+	void end_frame();
+	std::vector<ProfilePhase> get_phase_stats() const;
+	// Smoothed per-second rate of a counter.
+	double get_counter_rate(profile_counters counter) const;
+	// HUD text, one phase or counter per line.
+	std::vector<std::string> summary() const;
+
+	// Every span still in the ring buffers.
+	bool write_chrome_trace(const std::string& path) const;
+private:
+	Profiler();
+
+	// Spans each thread keeps before overwriting the oldest.
+	static const int _M_RING_SIZE = 1 << 14;
+	static const int _M_NUM_COUNTERS = (int)profile_counters::NUM_COUNTERS;
+
+	// Per-thread storage, only its own thread writes to it.
+	struct ThreadLog {
+		int thread;
+		std::vector<ProfileEvent> events;
+		std::atomic<uint64_t> head; // Spans ever written.
+		std::atomic<uint64_t> counters[_M_NUM_COUNTERS];
+		// end_frame() bookkeeping.
+		uint64_t read;
+		uint64_t last_counters[_M_NUM_COUNTERS];
+	};
+	ThreadLog* thread_log();
+
+	// Per name totals of the spans that ended in one frame.
+	struct FrameTotals { const char* name; double total_ms, max_ms; int spans; };
+
+	std::atomic<bool> _m_enabled;
+	std::chrono::steady_clock::time_point _m_epoch;
+	mutable std::mutex _m_mutex;
+	std::vector<std::unique_ptr<ThreadLog>> _m_logs;
+
+	// Rolling stats, guarded by _m_mutex.
+	// The frame totals are kept so end_frame() doesn't allocate.
+	std::vector<FrameTotals> _m_frame;
+	std::vector<ProfilePhase> _m_phases;
+	double _m_counter_rates[_M_NUM_COUNTERS];
+	uint64_t _m_last_frame_ns;
+};
+
+// Times its own lifetime.
+class ProfileScope {
+public:
+	ProfileScope(const char* name);
+	~ProfileScope();
+private:
+	const char* _mp_name;
+	uint64_t _m_start;
+};
+
+#endif
@@ -0,0 +1,413 @@
+// Recorder.cpp
+// Member function definitions for TrajectoryRecorder and TrajectoryReader.
+
+#include "recorder.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+static const char TRAJECTORY_MAGIC[4] = {'B', 'T', 'R', 'J'};
+static const char TRAJECTORY_INDEX_MAGIC[4] = {'B', 'T', 'R', 'I'};
+static const uint32_t TRAJECTORY_VERSION = 2;
+
+// Codec helpers, shared by the writer and the reader.
+// Quanta per world unit, so the bounds map onto 0..65535.
+static float quanta_scale(float min, float max) {
+	return (max > min)? 65535.0f / (max - min) : 1.0f;
+}
+
+static uint16_t quantize(float value, float min, float scale) {
+	float q = (value - min) * scale + 0.5f;
+	return (q <= 0.0f)? 0 : (q >= 65535.0f)? 65535 : (uint16_t)q;
+}
+
+// Guess for a boid's position from its last two, by how far
+// into the chunk we are. Everything is modulo 2^16, so a boid
+// wrapping around the world edge is still a small step.
+static uint16_t predict(int frame_in_chunk, uint16_t prev, uint16_t prev2) {
+	if (frame_in_chunk == 0) { return 0; }
+	if (frame_in_chunk == 1) { return prev; }
+	return (uint16_t)(2 * prev - prev2);
+}
+
+static uint32_t zigzag(int16_t value) {
+	return (uint16_t)(((uint16_t)value << 1) ^ (uint16_t)(value >> 15));
+}
+
+static int16_t unzigzag(uint32_t value) {
+	return (int16_t)((value >> 1) ^ (~(value & 1) + 1));
+}
+
+static void put_varint(std::vector<uint8_t>& out, uint32_t value) {
+	while (value >= 0x80) {
+		out.push_back((uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((uint8_t)value);
+}
+
+static bool get_varint(const uint8_t*& p, const uint8_t* end, uint32_t& value) {
+	value = 0;
+	for (int shift = 0; shift < 35 && p < end; shift += 7) {
+		uint8_t byte = *p++;
+		value |= (uint32_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void put_u32(std::vector<uint8_t>& out, uint32_t value) {
+	uint8_t bytes[4];
+	std::memcpy(bytes, &value, 4);
+	out.insert(out.end(), bytes, bytes + 4);
+}
+
+// Member function definitions for TrajectoryRecorder.
+TrajectoryRecorder::TrajectoryRecorder(int frames_per_chunk, int num_buffers):
+	_m_frames_per_chunk(std::max(1, frames_per_chunk)),
+	_m_recording(false),
+	_m_buffers(std::max(2, num_buffers)),
+	_m_stopping(false),
+	_m_recorded(0),
+	_m_dropped(0),
+	_m_step(0),
+	_m_chunk_frames(0),
+	_m_frame_count(0),
+	_m_offset(0)
+{}
+
+TrajectoryRecorder::~TrajectoryRecorder() {
+	stop();
+}
+
+bool TrajectoryRecorder::start(const std::string& path, const WorldBounds& bounds) {
+	stop();
+	_m_file.open(path, std::ios::binary | std::ios::trunc);
+	if (!_m_file) {
+		std::cout << "Unable to write trajectory " << path << "\n";
+		return false;
+	}
+	_m_header = {{'B', 'T', 'R', 'J'}, TRAJECTORY_VERSION,
+		(uint32_t)_m_frames_per_chunk, 0, bounds};
+	_m_file.write(reinterpret_cast<const char*>(&_m_header), sizeof(_m_header));
+	_m_offset = sizeof(_m_header);
+
+	_m_free.clear();
+	for (int i = 0; i < (int)_m_buffers.size(); i++) {
+		_m_free.push_back(i);
+	}
+	_m_queue.clear();
+	_m_index.clear();
+	_m_chunk.clear();
+	_m_chunk_frames = 0;
+	_m_frame_count = 0;
+	_m_recorded = 0;
+	_m_dropped = 0;
+	_m_step = 0;
+	_m_stopping = false;
+	_m_recording = true;
+	_m_writer = std::thread(&TrajectoryRecorder::writer_loop, this);
+	return true;
+}
+
+bool TrajectoryRecorder::record(const Flightspace& flock) {
+	if (!_m_recording) {
+		return false;
+	}
+	int buffer;
+	uint32_t step = _m_step++;
+	{
+		std::lock_guard<std::mutex> lock(_m_mutex);
+		if (_m_free.empty()) {
+			_m_dropped++;
+			return false;
+		}
+		buffer = _m_free.back();
+		_m_free.pop_back();
+	}
+
+	// Nobody else touches a buffer that is off the free list.
+	// Id order, so boid k is the same boid in every frame.
+	const FlockData* p_data = flock.get_flock_data();
+	p_data->to_id_order(p_data->x, _m_buffers[buffer].x);
+	p_data->to_id_order(p_data->y, _m_buffers[buffer].y);
+	_m_buffers[buffer].step = step;
+
+	{
+		std::lock_guard<std::mutex> lock(_m_mutex);
+		_m_queue.push_back(buffer);
+	}
+	_m_ready.notify_one();
+	return true;
+}
+
+bool TrajectoryRecorder::stop() {
+	if (!_m_recording) {
+		return true;
+	}
+	{
+		std::lock_guard<std::mutex> lock(_m_mutex);
+		_m_stopping = true;
+	}
+	_m_ready.notify_one();
+	_m_writer.join();
+
+	// Index, then the trailer that points at it.
+	TrajectoryTrailer trailer = {_m_offset, (uint32_t)_m_index.size(),
+		(uint32_t)_m_frame_count, {'B', 'T', 'R', 'I'}, 0};
+	_m_file.write(reinterpret_cast<const char*>(_m_index.data()),
+		sizeof(TrajectoryChunk) * _m_index.size());
+	_m_file.write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+	bool success = (bool)_m_file;
+	if (!success) {
+		std::cout << "Failed writing the trajectory\n";
+	}
+	_m_file.close();
+	_m_recording = false;
+	return success;
+}
+
+void TrajectoryRecorder::writer_loop() {
+	while (true) {
+		int buffer;
+		{
+			std::unique_lock<std::mutex> lock(_m_mutex);
+			_m_ready.wait(lock, [&] { return !_m_queue.empty() || _m_stopping; });
+			// Only leave once the queue is drained.
+			if (_m_queue.empty()) {
+				break;
+			}
+			buffer = _m_queue.front();
+			_m_queue.pop_front();
+		}
+		encode_frame(_m_buffers[buffer]);
+		_m_recorded++;
+		{
+			std::lock_guard<std::mutex> lock(_m_mutex);
+			_m_free.push_back(buffer);
+		}
+	}
+	write_chunk();
+}
+
+void TrajectoryRecorder::encode_frame(const FrameBuffer& frame) {
+	int count = frame.x.size();
+	// A different flock size starts a fresh chunk.
+	if (_m_chunk_frames > 0 && count != (int)_m_prev_x.size()) {
+		write_chunk();
+	}
+	if (_m_chunk_frames == 0) {
+		_m_prev_x.assign(count, 0); _m_prev_y.assign(count, 0);
+		_m_prev2_x.assign(count, 0); _m_prev2_y.assign(count, 0);
+	}
+
+	size_t start = _m_chunk.size();
+	put_u32(_m_chunk, count);
+	put_u32(_m_chunk, frame.step);
+	put_u32(_m_chunk, 0); // Payload size, patched below.
+
+	const WorldBounds& bounds = _m_header.bounds;
+	auto encode_axis = [&](const std::vector<float>& values, float min, float max,
+		std::vector<uint16_t>& prev, std::vector<uint16_t>& prev2)
+	{
+		float scale = quanta_scale(min, max);
+		for (int i = 0; i < count; i++) {
+			uint16_t q = quantize(values[i], min, scale);
+			uint16_t guess = predict(_m_chunk_frames, prev[i], prev2[i]);
+			put_varint(_m_chunk, zigzag((int16_t)(uint16_t)(q - guess)));
+			prev2[i] = prev[i];
+			prev[i] = q;
+		}
+	};
+	encode_axis(frame.x, bounds.xmin, bounds.xmax, _m_prev_x, _m_prev2_x);
+	encode_axis(frame.y, bounds.ymin, bounds.ymax, _m_prev_y, _m_prev2_y);
+
+	uint32_t payload = _m_chunk.size() - start - 12;
+	std::memcpy(&_m_chunk[start + 8], &payload, 4);
+
+	_m_chunk_frames++;
+	_m_frame_count++;
+	if (_m_chunk_frames == _m_frames_per_chunk) {
+		write_chunk();
+	}
+}
+
+void TrajectoryRecorder::write_chunk() {
+	if (_m_chunk_frames == 0) {
+		return;
+	}
+	TrajectoryChunk entry = {_m_offset,
+		(uint32_t)(_m_frame_count - _m_chunk_frames), (uint32_t)_m_chunk_frames};
+	_m_index.push_back(entry);
+	_m_file.write(reinterpret_cast<const char*>(_m_chunk.data()), _m_chunk.size());
+	_m_offset += _m_chunk.size();
+	_m_chunk.clear();
+	_m_chunk_frames = 0;
+}
+
+bool TrajectoryRecorder::is_recording() const {
+	return _m_recording;
+}
+
+int TrajectoryRecorder::get_recorded() const {
+	return _m_recorded;
+}
+
+int TrajectoryRecorder::get_dropped() const {
+	return _m_dropped;
+}
+
+// Member function definitions for TrajectoryReader.
+TrajectoryReader::TrajectoryReader():
+	_m_header(),
+	_m_frame_count(0)
+{}
+
+bool TrajectoryReader::open(const std::string& path) {
+	_m_index.clear();
+	_m_frame_count = 0;
+	if (!_m_file.open(path)) {
+		std::cout << "Unable to open trajectory " << path << "\n";
+		return false;
+	}
+
+	TrajectoryTrailer trailer;
+	if (_m_file.size() < sizeof(_m_header) + sizeof(trailer)) {
+		std::cout << "Trajectory " << path << " is too short\n";
+		return false;
+	}
+	std::memcpy(&_m_header, _m_file.data(), sizeof(_m_header));
+	std::memcpy(&trailer, _m_file.data() + _m_file.size() - sizeof(trailer),
+		sizeof(trailer));
+	if (std::memcmp(_m_header.magic, TRAJECTORY_MAGIC, 4) != 0 ||
+		std::memcmp(trailer.magic, TRAJECTORY_INDEX_MAGIC, 4) != 0 ||
+		_m_header.version < 1 || _m_header.version > TRAJECTORY_VERSION)
+	{
+		std::cout << "Trajectory " << path << " has the wrong format"
+			<< " or wasn't closed\n";
+		return false;
+	}
+	size_t index_size = sizeof(TrajectoryChunk) * (size_t)trailer.chunk_count;
+	if (trailer.index_offset + index_size + sizeof(trailer) > _m_file.size()) {
+		std::cout << "Trajectory " << path << " has a broken index\n";
+		return false;
+	}
+	_m_index.resize(trailer.chunk_count);
+	std::memcpy(_m_index.data(), _m_file.data() + trailer.index_offset, index_size);
+	_m_frame_count = trailer.frame_count;
+	return true;
+}
+
+int TrajectoryReader::get_frame_count() const {
+	return _m_frame_count;
+}
+
+int TrajectoryReader::get_frames_per_chunk() const {
+	return _m_header.frames_per_chunk;
+}
+
+WorldBounds TrajectoryReader::get_bounds() const {
+	return _m_header.bounds;
+}
+
+bool TrajectoryReader::read_frames(int first, int count,
+	std::vector<TrajectoryFrame>& out) const
+{
+	out.clear();
+	if (first < 0 || count < 0 || first + count > _m_frame_count) {
+		return false;
+	}
+	// Last chunk starting at or before first.
+	auto found = std::upper_bound(_m_index.begin(), _m_index.end(), (uint32_t)first,
+		[](uint32_t frame, const TrajectoryChunk& chunk) {
+			return frame < chunk.first_frame;
+		});
+	if (count == 0) {
+		return true;
+	}
+	if (found == _m_index.begin()) {
+		return false;
+	}
+
+	const WorldBounds& bounds = _m_header.bounds;
+	const uint8_t* file_start = reinterpret_cast<const uint8_t*>(_m_file.data());
+	const uint8_t* file_end = file_start + _m_file.size();
+	std::vector<uint16_t> prev_x, prev_y, prev2_x, prev2_y;
+	bool has_steps = (_m_header.version >= 2);
+	int frame_header = has_steps? 12 : 8;
+
+	// Decode from the chunk start, keeping the frames in range.
+	for (auto chunk = found - 1; chunk != _m_index.end() &&
+		(int)chunk->first_frame < first + count; ++chunk)
+	{
+		if (chunk->offset > _m_file.size()) { return false; }
+		const uint8_t* p = file_start + chunk->offset;
+		for (int k = 0; k < (int)chunk->frame_count; k++) {
+			int frame = chunk->first_frame + k;
+			uint32_t boids, step = frame, payload;
+			if (file_end - p < frame_header) { return false; }
+			std::memcpy(&boids, p, 4);
+			if (has_steps) { std::memcpy(&step, p + 4, 4); }
+			std::memcpy(&payload, p + frame_header - 4, 4);
+			p += frame_header;
+			// Every boid takes at least a byte per axis, which
+			// keeps a damaged count from sizing the buffers.
+			if (payload > (size_t)(file_end - p) || (uint64_t)boids * 2 > payload) {
+				return false;
+			}
+			const uint8_t* end = p + payload;
+			if (k == 0) {
+				prev_x.assign(boids, 0); prev_y.assign(boids, 0);
+				prev2_x.assign(boids, 0); prev2_y.assign(boids, 0);
+			}
+			// The writer starts a new chunk when the count changes,
+			// the predictions only hold this many boids.
+			else if (boids != prev_x.size()) {
+				return false;
+			}
+
+			bool wanted = (frame >= first && frame < first + count);
+			TrajectoryFrame* p_out = nullptr;
+			if (wanted) {
+				out.emplace_back();
+				p_out = &out.back();
+				p_out->x.resize(boids);
+				p_out->y.resize(boids);
+				p_out->step = step;
+			}
+
+			auto decode_axis = [&](float min, float max, std::vector<uint16_t>& prev,
+				std::vector<uint16_t>& prev2, std::vector<float>* p_values)
+			{
+				float scale = quanta_scale(min, max);
+				for (int i = 0; i < (int)boids; i++) {
+					uint32_t value;
+					if (!get_varint(p, end, value)) {
+						return false;
+					}
+					uint16_t q = (uint16_t)(predict(k, prev[i], prev2[i]) + unzigzag(value));
+					prev2[i] = prev[i];
+					prev[i] = q;
+					if (p_values != nullptr) {
+						(*p_values)[i] = min + q / scale;
+					}
+				}
+				return true;
+			};
+			if (!decode_axis(bounds.xmin, bounds.xmax, prev_x, prev2_x,
+					wanted? &p_out->x : nullptr) ||
+				!decode_axis(bounds.ymin, bounds.ymax, prev_y, prev2_y,
+					wanted? &p_out->y : nullptr))
+			{
+				return false;
+			}
+			p = end;
+			if (frame + 1 >= first + count) {
+				return true;
+			}
+		}
+	}
+	return (int)out.size() == count;
+}
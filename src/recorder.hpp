@@ -0,0 +1,137 @@
+// Recorder.h
+// Streams every frame's boid positions to a file for offline analysis.
+// Positions are quantized to 16 bits over the world bounds and stored
+// as the difference from a constant-velocity guess, in varints. Frames
+// are grouped into chunks that decode on their own, and an index at the
+// end of the file lets a reader jump to any chunk.
+
+#ifndef _RECORDER_H_
+#define _RECORDER_H_
+
+#include "classes.hpp"
+#include "mapped.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Trajectory file layout:
+// header, chunks of frames, chunk index, trailer.
+// A frame is its boid count, its step, its payload size in bytes and the
+// payload, which holds every boid's x residual followed by every y residual.
+// The step is the number of the record() call that made the frame, so
+// frames dropped while the writer was behind show up as gaps in it.
+// Version 1 files have no step, every frame's step is its index.
+struct TrajectoryHeader {
+	char magic[4]; // "BTRJ"
+	uint32_t version;
+	uint32_t frames_per_chunk;
+	uint32_t reserved;
+	WorldBounds bounds;
+};
+
+struct TrajectoryChunk {
+	uint64_t offset;
+	uint32_t first_frame;
+	uint32_t frame_count;
+};
+
+struct TrajectoryTrailer {
+	uint64_t index_offset;
+	uint32_t chunk_count;
+	uint32_t frame_count;
+	char magic[4]; // "BTRI"
+	uint32_t reserved;
+};
+
+// Records on a background thread. record() only copies the positions
+// into a free buffer, encoding and writing happen on the writer thread.
+class TrajectoryRecorder {
+public:
+	TrajectoryRecorder(int frames_per_chunk=64, int num_buffers=4);
+	~TrajectoryRecorder();
+
+	bool start(const std::string& path, const WorldBounds& bounds);
+	// Never waits on the writer. If every buffer is still queued
+	// the frame is dropped and counted, and false is returned.
+	// Either way the frame uses up a step number.
+	bool record(const Flightspace& flock);
+	// Writes whatever is queued plus the index, then closes the file.
+	bool stop();
+
+	bool is_recording() const;
+	int get_recorded() const;
+	int get_dropped() const;
+private:
+	// Copied positions of one frame.
+	struct FrameBuffer {
+		std::vector<float> x, y;
+		uint32_t step;
+	};
+
+	void writer_loop();
+	void encode_frame(const FrameBuffer& frame);
+	void write_chunk();
+
+	int _m_frames_per_chunk;
+	TrajectoryHeader _m_header;
+	std::ofstream _m_file;
+	bool _m_recording;
+
+	// Buffers cycle between the free list and the write queue.
+	std::vector<FrameBuffer> _m_buffers;
+	std::vector<int> _m_free;
+	std::deque<int> _m_queue;
+	bool _m_stopping;
+	std::mutex _m_mutex;
+	std::condition_variable _m_ready;
+	std::thread _m_writer;
+	std::atomic<int> _m_recorded, _m_dropped;
+	// Step of the next record() call, only touched by its caller.
+	uint32_t _m_step;
+
+	// Writer thread only.
+	// The last two quantized frames, for the prediction.
+	std::vector<uint16_t> _m_prev_x, _m_prev_y;
+	std::vector<uint16_t> _m_prev2_x, _m_prev2_y;
+	std::vector<uint8_t> _m_chunk;
+	int _m_chunk_frames;
+	int _m_frame_count;
+	uint64_t _m_offset;
+	std::vector<TrajectoryChunk> _m_index;
+};
+
+// Positions of one decoded frame, and the step it was recorded at.
+struct TrajectoryFrame {
+	std::vector<float> x, y;
+	uint32_t step;
+};
+
+// Reads trajectory files through a mapping.
+class TrajectoryReader {
+public:
+	TrajectoryReader();
+
+	bool open(const std::string& path);
+
+	int get_frame_count() const;
+	int get_frames_per_chunk() const;
+	WorldBounds get_bounds() const;
+
+	// Decodes frames [first, first + count). Only the chunks
+	// holding that range are touched. These are stored frames,
+	// check each one's step for frames dropped in between.
+	bool read_frames(int first, int count, std::vector<TrajectoryFrame>& out) const;
+private:
+	MappedFile _m_file;
+	TrajectoryHeader _m_header;
+	int _m_frame_count;
+	std::vector<TrajectoryChunk> _m_index;
+};
+
+#endif
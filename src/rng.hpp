@@ -1,36 +1,116 @@
 // Rng.h
-// Tiny header file to help make uniform random numbers
-// Credit goes to https://stackoverflow.com/questions/288739/generate-random-numbers-uniformly-over-an-entire-range
-// I used it for help.
+// Tiny header file to help make uniform random numbers.
+// Two generators:
+// - Pcg32, a small seedable generator, one per thread behind randint()/uniform().
+// - Counter based streams, where value i only depends on (seed, stream, i),
+//   so big batches can be filled in any order or in parallel and a
+//   seed always gives the same numbers.
 #ifndef _RNG_H_
 #define _RNG_H_
 
+#include <cstdint>
 #include <random>
 #include <utility>
 
-int randint(int min, int max) {
-	if (max < min) {
-		int temp(std::move(min));
-		min = std::move(max);
-		max = std::move(temp);
+// PCG32 (XSH RR), 16 bytes of state instead of the 5KB of a mt19937.
+class Pcg32 {
+public:
+	Pcg32(uint64_t seed=0x853c49e6748fea9bULL, uint64_t stream=0xda3e39cb94b95bdbULL) {
+		seed_with(seed, stream);
 	}
+
+	void seed_with(uint64_t seed, uint64_t stream=0xda3e39cb94b95bdbULL) {
+		_m_state = 0;
+		_m_inc = (stream << 1) | 1;
+		next_u32();
+		_m_state += seed;
+		next_u32();
+	}
+
+	uint32_t next_u32() {
+		uint64_t old = _m_state;
+		_m_state = old * 6364136223846793005ULL + _m_inc;
+		uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+		uint32_t rot = (uint32_t)(old >> 59);
+		return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+	}
+private:
+	uint64_t _m_state;
+	uint64_t _m_inc;
+};
+
+// Value number counter of a stream.
+inline uint32_t counter_u32(uint64_t seed, uint64_t stream, uint64_t counter) {
+	// Two rounds of the splitmix64 finalizer over the mixed key.
+	uint64_t z = seed ^ (stream * 0x9E3779B97F4A7C15ULL);
+	z += (counter + 1) * 0xD1B54A32D192ED03ULL;
+	for (int round = 0; round < 2; round++) {
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z ^= z >> 31;
+	}
+	return (uint32_t)(z >> 32);
+}
+
+// Maps 32 random bits to [min, max) or [min, max].
+inline float bits_to_uniform(uint32_t bits, float min, float max) {
+	// 24 bits is all a float can hold.
+	return min + (max - min) * ((bits >> 8) * (1.0f / 16777216.0f));
+}
+
+inline int bits_to_int(uint32_t bits, int min, int max) {
+	uint64_t range = (uint64_t)((int64_t)max - min) + 1;
+	return (int)(min + (int64_t)((bits * range) >> 32));
+}
+
+// Batch fills from a counter based stream.
+// Element k gets counter (offset + k), so filling [0, n) in chunks
+// from many threads gives the same result as one big fill.
+template <typename T>
+void fill_uniform(T* out, int count, float min, float max,
+	uint64_t seed, uint64_t stream, uint64_t offset=0)
+{
+	if (max < min) { std::swap(min, max); }
+	for (int k = 0; k < count; k++) {
+		out[k] = (T)bits_to_uniform(counter_u32(seed, stream, offset + k), min, max);
+	}
+}
+
+template <typename T>
+void fill_randint(T* out, int count, int min, int max,
+	uint64_t seed, uint64_t stream, uint64_t offset=0)
+{
+	if (max < min) { std::swap(min, max); }
+	for (int k = 0; k < count; k++) {
+		out[k] = (T)bits_to_int(counter_u32(seed, stream, offset + k), min, max);
+	}
+}
+
+// A fresh seed from the OS, for when nobody asked for one.
+inline uint64_t random_seed() {
 	std::random_device rng;
-	// Mersenne twister.
-	std::mt19937 generator(rng());
-	std::uniform_int_distribution<int> distr(min, max);
-	return distr(generator);
-}
-
-float uniform(float min, float max) {
-    if (max < min) {
-        float temp(std::move(min));
-        min = std::move(max);
-        max = std::move(temp);
-    }
-    std::random_device rng;
-    std::mt19937 generator(rng());
-    std::uniform_real_distribution<float> distr(min, max);
-    return distr(generator);
+	return ((uint64_t)rng() << 32) ^ rng();
+}
+
+// This thread's generator, seeded from the OS the first time it is used.
+inline Pcg32& thread_rng() {
+	thread_local Pcg32 generator(random_seed(), random_seed());
+	return generator;
+}
+
+// Reseeds this thread's generator so randint()/uniform() repeat.
+inline void seed_thread_rng(uint64_t seed) {
+	thread_rng().seed_with(seed);
+}
+
+inline int randint(int min, int max) {
+	if (max < min) { std::swap(min, max); }
+	return bits_to_int(thread_rng().next_u32(), min, max);
+}
+
+inline float uniform(float min, float max) {
+	if (max < min) { std::swap(min, max); }
+	return bits_to_uniform(thread_rng().next_u32(), min, max);
 }
 
 #endif
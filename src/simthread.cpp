@@ -0,0 +1,200 @@
+// Simthread.cpp
+// Member function definitions for SimThread.
+
+#include "simthread.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cmath>
+
+const int SimThread::_M_MAX_CATCHUP = 5;
+const float SimThread::_M_INDEX_CELLSIZE = 64.0f;
+
+SimThread::SimThread(Flightspace* p_flock, double rate):
+	_mp_flock(p_flock),
+	_m_running(false),
+	_m_steps(0)
+{
+	set_rate(rate);
+	_mp_index = new UniformGrid(_M_INDEX_CELLSIZE);
+	_mp_back_index = new UniformGrid(_M_INDEX_CELLSIZE);
+	// Something to draw before the first step.
+	publish();
+	publish();
+}
+
+SimThread::~SimThread() {
+	stop();
+	delete _mp_index;
+	delete _mp_back_index;
+}
+
+void SimThread::start() {
+	if (_m_running) {
+		return;
+	}
+	_m_running = true;
+	_m_thread = std::thread(&SimThread::run, this);
+}
+
+void SimThread::stop() {
+	if (!_m_running) {
+		return;
+	}
+	_m_running = false;
+	_m_thread.join();
+}
+
+void SimThread::set_rate(double rate) {
+	_m_rate = std::max(1.0, rate);
+}
+
+double SimThread::get_rate() const {
+	return _m_rate;
+}
+
+std::mutex& SimThread::get_mutex() {
+	return _m_sim_mutex;
+}
+
+long SimThread::get_steps() const {
+	return _m_steps;
+}
+
+// Fixed timestep. Each step is due one period after the last one
+// was due, not after it finished, so the rate holds on average.
+void SimThread::run() {
+	clock::time_point next = clock::now();
+	while (_m_running) {
+		clock::duration step = std::chrono::duration_cast<clock::duration>(
+			std::chrono::duration<double>(1.0 / _m_rate));
+		clock::time_point now = clock::now();
+		if (now < next) {
+			std::this_thread::sleep_until(std::min(next, now + step));
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> lock(_m_sim_mutex);
+			ProfileScope scope("sim step");
+			_mp_flock->update();
+			publish();
+		}
+		_m_steps++;
+		next += step;
+		// Way behind (slow machine, a breakpoint), start over
+		// from now instead of running a burst of steps.
+		if (clock::now() - next > _M_MAX_CATCHUP * step) {
+			next = clock::now();
+		}
+	}
+}
+
+// Copies the flock out, called with the sim mutex held.
+// In id order, the flock moves boids between slots but
+// blending needs the same boid at the same index in both steps.
+// Everything is built into the back frame and index, so drawing
+// only waits on the frame mutex for a few pointer swaps.
+void SimThread::publish() {
+	const FlockData* p_data = _mp_flock->get_flock_data();
+	p_data->to_id_order(p_data->x, _m_next.x);
+	p_data->to_id_order(p_data->y, _m_next.y);
+	p_data->to_id_order(p_data->dx, _m_next.dx);
+	p_data->to_id_order(p_data->dy, _m_next.dy);
+	p_data->to_id_order(p_data->species, _m_next.species);
+	WorldBounds bounds = _mp_flock->get_bounds();
+
+	// Bucket the new step for culling, same counting sort as the flock grid.
+	// Only reallocates when the world or the flock grew.
+	int size = _m_next.x.size();
+	_mp_back_index->set_bounds(bounds.xmin, bounds.ymin, bounds.xmax, bounds.ymax);
+	_mp_back_index->resize(size);
+	tbb::parallel_for(tbb::blocked_range<int>(0, size),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int i = r.begin(); i < r.end(); i++) {
+			_mp_back_index->assign(i, _m_next.x[i], _m_next.y[i]);
+		}
+	});
+	_mp_back_index->sort();
+
+	std::lock_guard<std::mutex> lock(_m_frame_mutex);
+	// The oldest step becomes the next back frame.
+	std::swap(_m_prev, _m_curr);
+	std::swap(_m_curr, _m_next);
+	std::swap(_mp_index, _mp_back_index);
+	_m_bounds = bounds;
+	_m_curr_time = clock::now();
+}
+
+void SimThread::get_frame(RenderFrame& out) {
+	std::lock_guard<std::mutex> lock(_m_frame_mutex);
+	blend(out, nullptr, _m_curr.x.size());
+}
+
+void SimThread::get_frame(RenderFrame& out, const WorldBounds& view) {
+	std::lock_guard<std::mutex> lock(_m_frame_mutex);
+	// A cell of margin catches boids blended in from just off screen.
+	_m_visible.clear();
+	const int* items = _mp_index->get_items();
+	_mp_index->query_rect(view.xmin - _M_INDEX_CELLSIZE, view.ymin - _M_INDEX_CELLSIZE,
+		view.xmax + _M_INDEX_CELLSIZE, view.ymax + _M_INDEX_CELLSIZE,
+	[&](int begin, int end) {
+		_m_visible.insert(_m_visible.end(), items + begin, items + end);
+	});
+	blend(out, _m_visible.data(), _m_visible.size());
+}
+
+void SimThread::get_density(DensityFrame& out, const WorldBounds& view) {
+	std::lock_guard<std::mutex> lock(_m_frame_mutex);
+	int cx_min = _mp_index->cell_x(view.xmin), cx_max = _mp_index->cell_x(view.xmax);
+	int cy_min = _mp_index->cell_y(view.ymin), cy_max = _mp_index->cell_y(view.ymax);
+	out.cellsize = _mp_index->get_cellsize();
+	out.xmin = _mp_index->get_xmin() + cx_min * out.cellsize;
+	out.ymin = _mp_index->get_ymin() + cy_min * out.cellsize;
+	out.cols = cx_max - cx_min + 1;
+	out.rows = cy_max - cy_min + 1;
+	out.counts.resize(out.cols * out.rows);
+	for (int cy = cy_min; cy <= cy_max; cy++) {
+		for (int cx = cx_min; cx <= cx_max; cx++) {
+			out.counts[(cy - cy_min) * out.cols + (cx - cx_min)] =
+				_mp_index->get_cell_count(_mp_index->pack(cx, cy));
+		}
+	}
+}
+
+// Called with the frame mutex held. A null boids means every boid.
+void SimThread::blend(RenderFrame& out, const int* boids, int count) {
+	int size = _m_curr.x.size();
+	out.x.resize(count); out.y.resize(count);
+	out.dx.resize(count); out.dy.resize(count);
+	out.species.resize(count);
+
+	// How far into the next step we are.
+	double elapsed = std::chrono::duration<double>(clock::now() - _m_curr_time).count();
+	float alpha = std::min(1.0, std::max(0.0, elapsed * _m_rate));
+	// The flock changed size (a snapshot load), nothing to blend with.
+	if ((int)_m_prev.x.size() != size) {
+		alpha = 1.0f;
+	}
+	// Steps longer than this are a wrap, not a move.
+	float wrap_x = 0.5f * (_m_bounds.xmax - _m_bounds.xmin);
+	float wrap_y = 0.5f * (_m_bounds.ymax - _m_bounds.ymin);
+
+	tbb::parallel_for(tbb::blocked_range<int>(0, count),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int k = r.begin(); k < r.end(); k++) {
+			int i = (boids != nullptr)? boids[k] : k;
+			float x0 = (alpha < 1.0f)? _m_prev.x[i] : _m_curr.x[i];
+			float y0 = (alpha < 1.0f)? _m_prev.y[i] : _m_curr.y[i];
+			float step_x = _m_curr.x[i] - x0, step_y = _m_curr.y[i] - y0;
+			bool wrapped = std::abs(step_x) > wrap_x || std::abs(step_y) > wrap_y;
+			float t = wrapped? 1.0f : alpha;
+			out.x[k] = x0 + step_x * t;
+			out.y[k] = y0 + step_y * t;
+			// Directions are only used for the rotation, the newest is fine.
+			out.dx[k] = _m_curr.dx[i];
+			out.dy[k] = _m_curr.dy[i];
+			out.species[k] = _m_curr.species[i];
+		}
+	});
+}
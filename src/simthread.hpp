@@ -0,0 +1,96 @@
+// Simthread.h
+// Runs the flock at a fixed rate on its own thread, so rendering
+// and vsync no longer decide how fast the boids move.
+
+#ifndef _SIMTHREAD_H_
+#define _SIMTHREAD_H_
+
+#include "classes.hpp"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Positions and directions for drawing one frame.
+struct RenderFrame {
+	std::vector<float> x, y;
+	std::vector<float> dx, dy;
+	std::vector<uint8_t> species;
+};
+
+// Boid counts on a grid, for drawing the flock zoomed far out.
+// Cell (cx, cy) has its top left corner at
+// (xmin + cx * cellsize, ymin + cy * cellsize).
+struct DensityFrame {
+	float xmin, ymin;
+	float cellsize;
+	int cols, rows;
+	std::vector<int> counts;
+};
+
+class SimThread {
+public:
+	SimThread(Flightspace* p_flock, double rate=60.0);
+	~SimThread();
+
+	void start();
+	void stop();
+
+	// Steps per second.
+	void set_rate(double rate);
+	double get_rate() const;
+
+	// Held for the whole of every step. Lock it before touching
+	// the flock, its obstacles or the boid weights from another thread.
+	std::mutex& get_mutex();
+
+	// The last two steps blended by how far we are into the next one,
+	// so drawing lags one step behind but moves smoothly.
+	// Boids that wrapped around the world edge aren't blended.
+	void get_frame(RenderFrame& out);
+	// Same, but only the boids in the cells of the render
+	// index overlapping view, so the cost follows what's on screen.
+	void get_frame(RenderFrame& out, const WorldBounds& view);
+	// Boid counts of the index cells overlapping view,
+	// without touching a single boid.
+	void get_density(DensityFrame& out, const WorldBounds& view);
+
+	long get_steps() const;
+private:
+	using clock = std::chrono::steady_clock;
+
+	void run();
+	void publish();
+	// Blends boids[0, count) of the last two steps into out.
+	void blend(RenderFrame& out, const int* boids, int count);
+
+	// Steps we run back to back before giving up on catching up.
+	static const int _M_MAX_CATCHUP;
+	// Cell size of the render index, much coarser than the flock grid
+	// so a screen full of view is only a few hundred cells.
+	static const float _M_INDEX_CELLSIZE;
+
+	Flightspace* _mp_flock;
+	std::atomic<double> _m_rate;
+	std::atomic<bool> _m_running;
+	std::atomic<long> _m_steps;
+	std::thread _m_thread;
+	std::mutex _m_sim_mutex;
+
+	// Published steps, guarded by _m_frame_mutex.
+	std::mutex _m_frame_mutex;
+	RenderFrame _m_prev, _m_curr;
+	WorldBounds _m_bounds;
+	// The current step's boids by cell, and the ones get_frame() picked.
+	UniformGrid* _mp_index;
+	std::vector<int> _m_visible;
+	clock::time_point _m_curr_time;
+
+	// The step being published, only touched with the sim mutex held.
+	// Swapped in as the current frame and index once it's built.
+	RenderFrame _m_next;
+	UniformGrid* _mp_back_index;
+};
+
+#endif
@@ -0,0 +1,177 @@
+// Snapshot.cpp
+// Snapshot saving and loading.
+
+#include "snapshot.hpp"
+#include "mapped.hpp"
+#include <tbb/parallel_reduce.h>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static const char SNAPSHOT_MAGIC[4] = {'B', 'S', 'N', 'P'};
+static const uint32_t SNAPSHOT_VERSION = 3;
+
+// Copies straight out of the mapped file. Split across threads,
+// since faulting in the pages is most of the work.
+static void copy_floats(std::vector<float>& out, const float* source, int count) {
+	out.resize(count);
+	tbb::parallel_for(tbb::blocked_range<int>(0, count, 1 << 16),
+	[&](tbb::blocked_range<int> r)
+	{
+		std::memcpy(out.data() + r.begin(), source + r.begin(),
+			sizeof(float) * (r.end() - r.begin()));
+	});
+}
+
+// Whether all count floats are numbers. Split across threads like the
+// copies, since this is the first pass over the pages.
+static bool all_finite(const float* values, size_t count) {
+	return tbb::parallel_reduce(tbb::blocked_range<size_t>(0, count, 1 << 16), true,
+	[&](tbb::blocked_range<size_t> r, bool finite)
+	{
+		for (size_t i = r.begin(); i < r.end() && finite; i++) {
+			finite = is_finite(values[i]);
+		}
+		return finite;
+	}, [](bool a, bool b) { return a && b; });
+}
+
+static void write_floats(std::ofstream& file, const float* data, int count) {
+	file.write(reinterpret_cast<const char*>(data), sizeof(float) * count);
+}
+
+bool save_snapshot(const std::string& path, const Flightspace& flock,
+	const ObstacleGroup* p_obstacles)
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		std::cout << "Unable to write snapshot " << path << "\n";
+		return false;
+	}
+
+	const FlockData* p_data = flock.get_flock_data();
+	const BucketGrid* p_index =
+		(p_obstacles != nullptr)? p_obstacles->get_index() : nullptr;
+	int boids = p_data->size();
+	int obstacles = (p_index != nullptr)? p_index->size() : 0;
+
+	SnapshotHeader header = {{'B', 'S', 'N', 'P'}, SNAPSHOT_VERSION,
+		(uint32_t)boids, (uint32_t)obstacles,
+		{Boid::m_separate, Boid::m_align, Boid::m_cohede, Boid::m_avoid},
+		flock.get_bounds()};
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	std::vector<float> ordered;
+	for (const std::vector<float>* p_field : {&p_data->x, &p_data->y,
+		&p_data->dx, &p_data->dy, &p_data->speed, &p_data->agility})
+	{
+		p_data->to_id_order(*p_field, ordered);
+		write_floats(file, ordered.data(), boids);
+	}
+	if (p_index != nullptr) {
+		write_floats(file, p_index->get_xs(), obstacles);
+		write_floats(file, p_index->get_ys(), obstacles);
+	}
+	std::vector<uint8_t> species;
+	p_data->to_id_order(p_data->species, species);
+	file.write(reinterpret_cast<const char*>(species.data()), boids);
+	const SpeciesTable& table = flock.get_species();
+	file.write(reinterpret_cast<const char*>(&table), sizeof(table));
+	return (bool)file;
+}
+
+bool load_snapshot(const std::string& path, Flightspace* p_flock,
+	ObstacleGroup* p_obstacles)
+{
+	MappedFile file;
+	if (!file.open(path)) {
+		std::cout << "Unable to open snapshot " << path << "\n";
+		return false;
+	}
+
+	SnapshotHeader header;
+	if (file.size() < sizeof(header)) {
+		std::cout << "Snapshot " << path << " is too short\n";
+		return false;
+	}
+	std::memcpy(&header, file.data(), sizeof(header));
+	if (std::memcmp(header.magic, SNAPSHOT_MAGIC, 4) != 0 ||
+		header.version < 1 || header.version > SNAPSHOT_VERSION)
+	{
+		std::cout << "Snapshot " << path << " has the wrong format\n";
+		return false;
+	}
+	size_t floats = 6 * (size_t)header.boid_count + 2 * (size_t)header.obstacle_count;
+	size_t species_bytes = (header.version >= 2)? header.boid_count : 0;
+	size_t table_bytes = (header.version >= 3)? sizeof(SpeciesTable) : 0;
+	if (file.size() < sizeof(header) + sizeof(float) * floats + species_bytes + table_bytes) {
+		std::cout << "Snapshot " << path << " is truncated\n";
+		return false;
+	}
+
+	// Everything is checked before touching the flock. Bounds the
+	// grid can't be built over, or a position that isn't a number,
+	// would leave it broken.
+	if (header.boid_count > INT_MAX || header.obstacle_count > INT_MAX) {
+		std::cout << "Snapshot " << path << " has too many boids or obstacles\n";
+		return false;
+	}
+	if (!world_fits(header.bounds, p_flock->get_cellsize())) {
+		std::cout << "Snapshot " << path << " has bounds that aren't a world in cells of "
+			<< p_flock->get_cellsize() << "\n";
+		return false;
+	}
+	const float* p_floats = reinterpret_cast<const float*>(file.data() + sizeof(header));
+	if (!all_finite(header.weights, 4) || !all_finite(p_floats, floats)) {
+		std::cout << "Snapshot " << path << " has a value that isn't a number\n";
+		return false;
+	}
+	// An id past the table would index the per-species weights out of bounds.
+	const uint8_t* p_species = reinterpret_cast<const uint8_t*>(p_floats + floats);
+	SpeciesTable table = p_flock->get_species();
+	if (table_bytes > 0) {
+		std::memcpy(&table, p_species + species_bytes, table_bytes);
+	}
+	if (table.count < 1 || table.count > MAX_SPECIES) {
+		std::cout << "Snapshot " << path << " has a bad species table\n";
+		return false;
+	}
+	for (size_t i = 0; i < species_bytes; i++) {
+		if (p_species[i] >= table.count) {
+			std::cout << "Snapshot " << path << " has boids of species "
+				<< (int)p_species[i] << ", there are only " << table.count << "\n";
+			return false;
+		}
+	}
+
+	// Bounds first, the obstacle index is sized from them.
+	const WorldBounds& bounds = header.bounds;
+	p_flock->set_bounds(bounds.xmin, bounds.ymin, bounds.xmax, bounds.ymax);
+	Boid::change_behaviour(header.weights[0], header.weights[1],
+		header.weights[2], header.weights[3]);
+	p_flock->set_species(table);
+
+	int boids = header.boid_count;
+	FlockData* p_data = p_flock->get_flock_data();
+	copy_floats(p_data->x, p_floats, boids);
+	copy_floats(p_data->y, p_floats + boids, boids);
+	copy_floats(p_data->dx, p_floats + 2 * boids, boids);
+	copy_floats(p_data->dy, p_floats + 3 * boids, boids);
+	copy_floats(p_data->speed, p_floats + 4 * boids, boids);
+	copy_floats(p_data->agility, p_floats + 5 * boids, boids);
+	p_data->species.assign(boids, 0);
+	if (species_bytes > 0) {
+		std::memcpy(p_data->species.data(), p_species, species_bytes);
+	}
+	p_data->neighbors.assign(boids, 0);
+	p_data->reset_ids();
+	p_flock->reset_neighbor_lists();
+
+	if (p_obstacles != nullptr) {
+		const float* p_obstacle_xs = p_floats + 6 * boids;
+		p_obstacles->clear_all();
+		p_obstacles->add_obstacles(p_obstacle_xs,
+			p_obstacle_xs + header.obstacle_count, header.obstacle_count);
+	}
+	return true;
+}
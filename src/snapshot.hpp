@@ -0,0 +1,42 @@
+// Snapshot.h
+// Saves and restores the whole simulation state: every boid,
+// the obstacles, the behaviour weights and the world bounds.
+// Good for reproducing a flock that did something odd.
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "classes.hpp"
+#include <string>
+#include <cstdint>
+
+// Snapshot file: this header, then the six boid arrays
+// (x, y, dx, dy, speed, agility) of boid_count floats each, then the
+// obstacle x and y arrays of obstacle_count floats, then (version 2)
+// one species id byte per boid, then (version 3) the SpeciesTable as is.
+// Little endian. Boids are saved in id order, so boid k of the file is id k.
+// Version 1 files have no species, every boid loads as species 0.
+// Version 2 files keep the flock's current species table.
+// Species ids the table doesn't have are rejected.
+// The perception radius and cell size aren't saved, a snapshot runs with
+// whatever the loading flock has (the config). Bounds that aren't finite,
+// are inverted or too big for its grid, see world_fits(), are rejected,
+// and so are boid and obstacle values that aren't numbers.
+struct SnapshotHeader {
+	char magic[4]; // "BSNP"
+	uint32_t version;
+	uint32_t boid_count;
+	uint32_t obstacle_count;
+	// Boid::m_separate, m_align, m_cohede and m_avoid.
+	float weights[4];
+	WorldBounds bounds;
+};
+
+// p_obstacles may be null, then no obstacles are saved or loaded.
+bool save_snapshot(const std::string& path, const Flightspace& flock,
+	const ObstacleGroup* p_obstacles);
+// Replaces the flock and obstacles, and sets the weights, bounds and species.
+bool load_snapshot(const std::string& path, Flightspace* p_flock,
+	ObstacleGroup* p_obstacles);
+
+#endif
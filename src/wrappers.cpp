@@ -3,6 +3,7 @@
 
 // Uses wrappers.h
 #include "wrappers.hpp"
+#include <algorithm>
 #include <cmath>
 
 // Member function definitions for SDL Wrapper.
@@ -78,14 +79,144 @@ int TextureWrap::get_h() const {
 	return h;
 }
 
+SDL_Texture* TextureWrap::get_texture() const {
+	return _mp_texture;
+}
+
+// SpriteBatch member function definitions.
+SpriteBatch::SpriteBatch(const TextureWrap* p_texture, int shrink):
+	_mp_texture(p_texture),
+	_m_shrink(std::max(1, shrink)),
+	_m_scale(1.0f),
+	_m_count(0)
+{}
+
+void SpriteBatch::set_scale(float scale) {
+	_m_scale = scale;
+}
+
+void SpriteBatch::resize(int count) {
+	int old_size = _m_indices.size() / 6;
+	if (count > old_size) {
+		_m_vertices.resize(count * 4);
+		_m_indices.resize(count * 6);
+		// Two triangles per quad, never changes.
+		for (int i = old_size; i < count; i++) {
+			int* index = &_m_indices[i * 6];
+			index[0] = i*4; index[1] = i*4 + 1; index[2] = i*4 + 2;
+			index[3] = i*4; index[4] = i*4 + 2; index[5] = i*4 + 3;
+		}
+	}
+	_m_count = count;
+}
+
+void SpriteBatch::set_sprite(int index, float x, float y,
+	float dir_x, float dir_y, SDL_Color tint)
+{
+	float half_w = 0.5f * (_mp_texture->get_w() / _m_shrink) * _m_scale;
+	float half_h = 0.5f * (_mp_texture->get_h() / _m_shrink) * _m_scale;
+	float center_x = x + half_w;
+	float center_y = y + half_h;
+
+	// The direction already is the cos and sin of the angle,
+	// so no trig is needed.
+	float length = std::sqrt(dir_x*dir_x + dir_y*dir_y);
+	float c = 1.0f, s = 0.0f;
+	if (length > 0.0f) {
+		c = dir_x / length;
+		s = dir_y / length;
+	}
+
+	// Corners clockwise from the top left, same as RenderCopyEx.
+	const float corner_x[4] = {-half_w, half_w, half_w, -half_w};
+	const float corner_y[4] = {-half_h, -half_h, half_h, half_h};
+	const float tex_u[4] = {0.0f, 1.0f, 1.0f, 0.0f};
+	const float tex_v[4] = {0.0f, 0.0f, 1.0f, 1.0f};
+	SDL_Vertex* vertex = &_m_vertices[index * 4];
+	for (int k = 0; k < 4; k++) {
+		vertex[k].position.x = center_x + corner_x[k]*c - corner_y[k]*s;
+		vertex[k].position.y = center_y + corner_x[k]*s + corner_y[k]*c;
+		vertex[k].color = tint;
+		vertex[k].tex_coord.x = tex_u[k];
+		vertex[k].tex_coord.y = tex_v[k];
+	}
+}
+
+void SpriteBatch::render(SDL_Renderer* p_renderer) const {
+	if (_m_count == 0 || _mp_texture->get_texture() == NULL) {
+		return;
+	}
+	if (SDL_RenderGeometry(p_renderer, _mp_texture->get_texture(),
+		_m_vertices.data(), _m_count * 4, _m_indices.data(), _m_count * 6) != 0)
+	{
+		error_msg("Unable to render sprite batch!", error_types::REGULAR_ERROR);
+	}
+}
+
+int SpriteBatch::get_size() const {
+	return _m_count;
+}
+
+// RectBatch member function definitions.
+RectBatch::RectBatch():
+	_m_count(0)
+{}
+
+void RectBatch::resize(int count) {
+	int old_size = _m_indices.size() / 6;
+	if (count > old_size) {
+		_m_vertices.resize(count * 4);
+		_m_indices.resize(count * 6);
+		for (int i = old_size; i < count; i++) {
+			int* index = &_m_indices[i * 6];
+			index[0] = i*4; index[1] = i*4 + 1; index[2] = i*4 + 2;
+			index[3] = i*4; index[4] = i*4 + 2; index[5] = i*4 + 3;
+		}
+	}
+	_m_count = count;
+}
+
+void RectBatch::set_rect(int index, float x, float y, float w, float h, SDL_Color color) {
+	const float corner_x[4] = {x, x + w, x + w, x};
+	const float corner_y[4] = {y, y, y + h, y + h};
+	SDL_Vertex* vertex = &_m_vertices[index * 4];
+	for (int k = 0; k < 4; k++) {
+		vertex[k].position.x = corner_x[k];
+		vertex[k].position.y = corner_y[k];
+		vertex[k].color = color;
+		vertex[k].tex_coord.x = 0.0f;
+		vertex[k].tex_coord.y = 0.0f;
+	}
+}
+
+void RectBatch::render(SDL_Renderer* p_renderer) const {
+	if (_m_count == 0) {
+		return;
+	}
+	if (SDL_RenderGeometry(p_renderer, NULL,
+		_m_vertices.data(), _m_count * 4, _m_indices.data(), _m_count * 6) != 0)
+	{
+		error_msg("Unable to render rect batch!", error_types::REGULAR_ERROR);
+	}
+}
+
+int RectBatch::get_size() const {
+	return _m_count;
+}
+
 // Textbox member function definition area.
 TextBox::TextBox(const std::string& fontname, unsigned int size):
+	w(0),
+	h(0),
 	_m_fontsize(size),
-    _m_fontname(fontname)
+    _m_fontname(fontname),
+	_m_atlas_w(0),
+	_m_atlas_h(0)
 {
 	// Nullify.
 	_mp_font = NULL;
 	_mp_render_box = NULL;
+	_mp_atlas = NULL;
 }
 
 TextBox::~TextBox() {
@@ -93,26 +224,47 @@ TextBox::~TextBox() {
 }
 
 void TextBox::configure(const std::string& fontname, unsigned int size) {
+	// A different font makes everything cached stale.
+	if (fontname != _m_fontname || size != _m_fontsize) {
+		clear_data();
+	}
 	_m_fontname = fontname;
 	_m_fontsize = size;
 }
 
 bool TextBox::load_text(const std::string& msg, SDL_Renderer* p_renderer) {
+	// Same string, keep the texture we already have.
+	if (_mp_render_box != NULL && msg == _m_text) {
+		return true;
+	}
+
 	bool success = true;
-	clear_data(); // Remove old data.
-	_mp_font = TTF_OpenFont(_m_fontname.c_str(), _m_fontsize);
-	if (!_mp_font) {
-		error_msg("Failed to load font!", error_types::TEXT_ERROR);
+	free_text(); // Remove old texture.
+	if (!open_font()) {
 		success = false;
 	}
 	else {
 		if (!create_texture(msg, p_renderer)) {
 			success = false;
 		}
+		else {
+			_m_text = msg;
+		}
 	}
 	return success;
 }
 
+bool TextBox::open_font() {
+	// Opened once and kept until clear_data().
+	if (_mp_font == NULL) {
+		_mp_font = TTF_OpenFont(_m_fontname.c_str(), _m_fontsize);
+		if (!_mp_font) {
+			error_msg("Failed to load font!", error_types::TEXT_ERROR);
+		}
+	}
+	return _mp_font != NULL;
+}
+
 bool TextBox::create_texture(const std::string& msg, SDL_Renderer* p_renderer)
 {
 	bool success = true;
@@ -153,17 +305,136 @@ void TextBox::show_text_at(int x, int y, double rotation,
 		rotation, NULL, SDL_FLIP_NONE);
 }
 
-void TextBox::clear_data() {
-	if (_mp_font != NULL) {
-		TTF_CloseFont(_mp_font);
-		_mp_font = NULL;
+// Renders every printable character once, in a row.
+// Glyph k starts where the text before it ends, so the
+// atlas lines up with how the font lays out the string.
+bool TextBox::load_atlas(SDL_Renderer* p_renderer) {
+	if (_mp_atlas != NULL) {
+		return true;
+	}
+	if (!open_font()) {
+		return false;
 	}
+
+	std::string charset;
+	for (char glyph = _M_FIRST_GLYPH; glyph <= _M_LAST_GLYPH; glyph++) {
+		charset += glyph;
+	}
+	SDL_Color color = {0xFF, 0xFF, 0xFF, 0x90};
+	SDL_Surface* p_atlas_surf = TTF_RenderText_Solid(
+		_mp_font, charset.c_str(), color);
+	if (!p_atlas_surf) {
+		error_msg("Failed to render glyph atlas!", error_types::TEXT_ERROR);
+		return false;
+	}
+
+	_mp_atlas = SDL_CreateTextureFromSurface(p_renderer, p_atlas_surf);
+	if (_mp_atlas == NULL) {
+		error_msg("Unable to create glyph atlas texture!",
+			error_types::REGULAR_ERROR);
+	}
+	else {
+		_m_atlas_w = p_atlas_surf->w;
+		_m_atlas_h = p_atlas_surf->h;
+		_m_glyphs.resize(charset.size());
+		int start = 0;
+		for (int k = 0; k < (int)charset.size(); k++) {
+			int end = 0, text_h = 0;
+			TTF_SizeText(_mp_font, charset.substr(0, k + 1).c_str(), &end, &text_h);
+			_m_glyphs[k] = SDL_Rect{start, 0, end - start, _m_atlas_h};
+			start = end;
+		}
+	}
+	SDL_FreeSurface(p_atlas_surf);
+	p_atlas_surf = NULL;
+	return _mp_atlas != NULL;
+}
+
+bool TextBox::has_atlas() const {
+	return _mp_atlas != NULL;
+}
+
+const SDL_Rect* TextBox::glyph_rect(char glyph) const {
+	if (glyph < _M_FIRST_GLYPH || glyph > _M_LAST_GLYPH || _m_glyphs.empty()) {
+		return nullptr;
+	}
+	return &_m_glyphs[glyph - _M_FIRST_GLYPH];
+}
+
+// Builds one quad per character and draws them in a single call.
+void TextBox::show_glyphs_at(int x, int y, const std::string& msg,
+	SDL_Renderer* p_renderer)
+{
+	if (_mp_atlas == NULL) {
+		return;
+	}
+	// Buffers only grow, so steady labels don't allocate.
+	_m_glyph_vertices.clear();
+	_m_glyph_indices.clear();
+	float pen_x = x;
+	for (char glyph : msg) {
+		const SDL_Rect* p_rect = glyph_rect(glyph);
+		if (p_rect == nullptr) {
+			continue;
+		}
+		int first = _m_glyph_vertices.size();
+		float u0 = (float)p_rect->x / _m_atlas_w;
+		float u1 = (float)(p_rect->x + p_rect->w) / _m_atlas_w;
+		float left = pen_x, right = pen_x + p_rect->w;
+		float top = y, bottom = y + p_rect->h;
+		SDL_Color color = {0xFF, 0xFF, 0xFF, 0xFF};
+		_m_glyph_vertices.push_back(SDL_Vertex{{left, top}, color, {u0, 0.0f}});
+		_m_glyph_vertices.push_back(SDL_Vertex{{right, top}, color, {u1, 0.0f}});
+		_m_glyph_vertices.push_back(SDL_Vertex{{right, bottom}, color, {u1, 1.0f}});
+		_m_glyph_vertices.push_back(SDL_Vertex{{left, bottom}, color, {u0, 1.0f}});
+		for (int corner : {0, 1, 2, 0, 2, 3}) {
+			_m_glyph_indices.push_back(first + corner);
+		}
+		pen_x = right;
+	}
+	if (!_m_glyph_indices.empty()) {
+		SDL_RenderGeometry(p_renderer, _mp_atlas,
+			_m_glyph_vertices.data(), _m_glyph_vertices.size(),
+			_m_glyph_indices.data(), _m_glyph_indices.size());
+	}
+}
+
+int TextBox::get_glyphs_w(const std::string& msg) const {
+	int width = 0;
+	for (char glyph : msg) {
+		const SDL_Rect* p_rect = glyph_rect(glyph);
+		width += (p_rect != nullptr)? p_rect->w : 0;
+	}
+	return width;
+}
+
+int TextBox::get_glyphs_h() const {
+	return _m_atlas_h;
+}
+
+void TextBox::free_text() {
 	if (_mp_render_box != NULL) {
 		SDL_DestroyTexture(_mp_render_box);
 		_mp_render_box = NULL;
 		w = 0;
 		h = 0;
 	}
+	_m_text.clear();
+}
+
+void TextBox::clear_data() {
+	free_text();
+	if (_mp_atlas != NULL) {
+		SDL_DestroyTexture(_mp_atlas);
+		_mp_atlas = NULL;
+		_m_atlas_w = 0;
+		_m_atlas_h = 0;
+		_m_glyphs.clear();
+	}
+	if (_mp_font != NULL) {
+		TTF_CloseFont(_mp_font);
+		_mp_font = NULL;
+	}
 }
 
 int TextBox::get_w() const {
@@ -588,10 +859,13 @@ void Slider::render_parts(SDL_Renderer* const p_renderer,
 
     // Text render.
     if (_p_textbox != nullptr) {
+        // The value changes while dragging, so draw it from the glyph atlas.
         float rounded_val = std::ceil(_current_value * 1000.0f) / 1000.0f;
-        _p_textbox->load_text(value_name + std::to_string(rounded_val), p_renderer);
-        int tb_height = _p_textbox->get_h();
-        _p_textbox->show_text_at(_bar_rect.x, _bar_rect.y - tb_height, 0.0, p_renderer);
+        if (_p_textbox->has_atlas() || _p_textbox->load_atlas(p_renderer)) {
+            int tb_height = _p_textbox->get_glyphs_h();
+            _p_textbox->show_glyphs_at(_bar_rect.x, _bar_rect.y - tb_height,
+                value_name + std::to_string(rounded_val), p_renderer);
+        }
     }
 
     // Button render
@@ -606,3 +880,40 @@ void Slider::_set_button_pos(int mouse_x) {
     _button_rect.x = mouse_x - (_button_rect.w / 2);;
     _current_value = range_map(mouse_x, _lpos, _rpos, min_output, max_output);
 }
+
+bool load_mask_points(const std::string& path, std::vector<float>& xs,
+	std::vector<float>& ys, int step)
+{
+	step = std::max(1, step);
+	SDL_Surface* p_loaded = IMG_Load(path.c_str());
+	if (p_loaded == NULL) {
+		error_msg("Unable to load obstacle mask!", error_types::IMAGE_ERROR);
+		return false;
+	}
+	// Whatever the file was, read it as RGBA bytes.
+	SDL_Surface* p_mask = SDL_ConvertSurfaceFormat(
+		p_loaded, SDL_PIXELFORMAT_RGBA32, 0);
+	SDL_FreeSurface(p_loaded);
+	p_loaded = NULL;
+	if (p_mask == NULL) {
+		error_msg("Unable to convert obstacle mask!", error_types::REGULAR_ERROR);
+		return false;
+	}
+
+	SDL_LockSurface(p_mask);
+	const uint8_t* pixels = static_cast<const uint8_t*>(p_mask->pixels);
+	for (int y = 0; y < p_mask->h; y += step) {
+		const uint8_t* row = pixels + y * p_mask->pitch;
+		for (int x = 0; x < p_mask->w; x += step) {
+			const uint8_t* rgba = row + x * 4;
+			if (rgba[3] >= 0x80 && (rgba[0] + rgba[1] + rgba[2]) >= 3 * 0x80) {
+				xs.push_back(x);
+				ys.push_back(y);
+			}
+		}
+	}
+	SDL_UnlockSurface(p_mask);
+	SDL_FreeSurface(p_mask);
+	p_mask = NULL;
+	return true;
+}
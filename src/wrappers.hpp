@@ -6,6 +6,7 @@
 // Uses vector
 #include <vector>
 #include <cstdint>
+#include <tbb/parallel_for.h>
 
 // Uses wrappers.h
 #include "tinyerror.hpp"
@@ -13,6 +14,8 @@
 // Class forward declarations.
 // Graphics Wrapper Classes
 class TextureWrap;
+class SpriteBatch;
+class RectBatch;
 class TextBox;
 
 // Sound Wrapper Classes
@@ -38,12 +41,78 @@ public:
 	// Gets image dimensions
 	int get_w() const;
 	int get_h() const;
+	SDL_Texture* get_texture() const;
 private:
 	int w, h;
 	SDL_Texture* _mp_texture;
 };
 
+// Draws lots of copies of one texture with a single SDL_RenderGeometry call.
+// Each sprite is a quad rotated about its center, sized like render_at().
+// Needs SDL 2.0.18 or newer.
+class SpriteBatch {
+public:
+	SpriteBatch(const TextureWrap* p_texture, int shrink=1);
+
+	// Sets the number of sprites, only allocates when it grows.
+	void resize(int count);
+	// Sprite size multiplier, for zooming.
+	void set_scale(float scale);
+	// Top left corner at (x, y) facing (dir_x, dir_y).
+	// Different sprites can be set from different threads.
+	void set_sprite(int index, float x, float y,
+		float dir_x=1.0f, float dir_y=0.0f,
+		SDL_Color tint=SDL_Color{0xFF, 0xFF, 0xFF, 0xFF});
+	// Fills every sprite in parallel, sprite_at(i) calls set_sprite(i, ...).
+	template <typename Func>
+	void build(int count, Func sprite_at);
+	// One draw call for the whole batch.
+	void render(SDL_Renderer* p_renderer) const;
+
+	int get_size() const;
+private:
+	const TextureWrap* _mp_texture;
+	int _m_shrink;
+	float _m_scale;
+	int _m_count;
+	std::vector<SDL_Vertex> _m_vertices;
+	std::vector<int> _m_indices;
+};
+
+// Solid colored rectangles in a single SDL_RenderGeometry call,
+// like SpriteBatch without a texture.
+class RectBatch {
+public:
+	RectBatch();
+
+	// Sets the number of rectangles, only allocates when it grows.
+	void resize(int count);
+	void set_rect(int index, float x, float y, float w, float h, SDL_Color color);
+	void render(SDL_Renderer* p_renderer) const;
+
+	int get_size() const;
+private:
+	int _m_count;
+	std::vector<SDL_Vertex> _m_vertices;
+	std::vector<int> _m_indices;
+};
+
+template <typename Func>
+void SpriteBatch::build(int count, Func sprite_at) {
+	resize(count);
+	tbb::parallel_for(tbb::blocked_range<int>(0, count),
+	[&](tbb::blocked_range<int> r)
+	{
+		for (int i = r.begin(); i < r.end(); i++) {
+			sprite_at(i);
+		}
+	});
+}
+
 // Text display class.
+// Keeps its font open and only re-renders when the string changes.
+// Text that changes every frame can use the glyph atlas instead,
+// which draws cached glyph quads without rasterizing anything.
 class TextBox {
 public:
 	TextBox(const std::string& fontname="", unsigned int size=12);
@@ -56,6 +125,14 @@ public:
 	void show_text_at(int x, int y,
 		double rotation, SDL_Renderer* p_renderer) const;
 
+	// Glyph atlas, printable ASCII only.
+	bool load_atlas(SDL_Renderer* p_renderer);
+	bool has_atlas() const;
+	void show_glyphs_at(int x, int y, const std::string& msg,
+		SDL_Renderer* p_renderer);
+	int get_glyphs_w(const std::string& msg) const;
+	int get_glyphs_h() const;
+
 	// Deallocator
 	void clear_data();
 
@@ -66,12 +143,25 @@ private:
 	int w, h;
 	unsigned int _m_fontsize;
 	std::string _m_fontname;
+	std::string _m_text; // What _mp_render_box shows.
 	SDL_Texture* _mp_render_box;
 	TTF_Font* _mp_font;
 
+	// Atlas data.
+	static const char _M_FIRST_GLYPH = ' ';
+	static const char _M_LAST_GLYPH = '~';
+	int _m_atlas_w, _m_atlas_h;
+	SDL_Texture* _mp_atlas;
+	std::vector<SDL_Rect> _m_glyphs;
+	std::vector<SDL_Vertex> _m_glyph_vertices;
+	std::vector<int> _m_glyph_indices;
+
 	// Private functions.
+	bool open_font();
+	void free_text();
 	bool create_texture(const std::string& msg,
 		SDL_Renderer* p_renderer);
+	const SDL_Rect* glyph_rect(char glyph) const;
 };
 
 // Music player class.
@@ -203,4 +293,10 @@ private:
     TextBox* _p_textbox;
 };
 
+// Obstacle points from an image mask (any format SDL_image reads).
+// Every step-th pixel in both directions that is opaque and brighter
+// than mid grey becomes a point at its pixel coordinates.
+bool load_mask_points(const std::string& path, std::vector<float>& xs,
+	std::vector<float>& ys, int step=4);
+
 #endif